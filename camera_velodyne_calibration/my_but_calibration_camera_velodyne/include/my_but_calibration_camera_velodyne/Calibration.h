@@ -3,11 +3,21 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <cmath>
 #include <iostream>
 
+#include <vector>
+#include <algorithm>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
 #include "opencv2/opencv.hpp"
 #include <pcl/point_cloud.h>
 #include <pcl/io/pcd_io.h>
+#include <pcl/common/eigen.h>
+#include <ros/assert.h>
+#include <ros/console.h>
 
 #include <my_but_calibration_camera_velodyne/Velodyne.h>
 #include <my_but_calibration_camera_velodyne/Similarity.h>
@@ -99,6 +109,620 @@ public:
   }
 };
 
+/*
+ * Options of the coarse-to-fine refinement: a coarse_steps^6 grid on the
+ * most blurred edge image, then Nelder-Mead from the best seeds down the
+ * pyramid until the simplex is smaller than the tolerances.
+ */
+struct RefinementOptions
+{
+  unsigned coarse_steps;
+  unsigned seeds;
+  unsigned pyramid_levels;
+  float tolerance_translation; // [m]
+  float tolerance_rotation; // [rad]
+  unsigned max_iterations; // of the simplex, per level
+  Similarity::Criteria criteria;
+
+  RefinementOptions() :
+      coarse_steps(3), seeds(4), pyramid_levels(3), tolerance_translation(0.001), tolerance_rotation(0.0005),
+      max_iterations(200), criteria(Similarity::CC)
+  {
+  }
+};
+
+/*
+ * Search of the 6DoF calibration around the coarse one, scored by the
+ * edge similarity of the scans and the IDT edge images of one or more
+ * frames, summed over the frames. The similarity is the cross-correlation
+ * (CC) or the mutual information (MI, NMI) of the pixels hit by the points
+ * and the point intensities, both taken as 8-bit values.
+ *
+ * Every scan is packed once into plain arrays. A candidate does not copy
+ * the clouds: its transformation is folded into the projection matrix of
+ * a frame and the points go through that single 3 x 4 product. Candidates
+ * (or the frames of one) are scored in parallel, each thread with its own
+ * scratch, and reduced in a fixed order, so the result does not depend on
+ * the number of threads.
+ */
+class CalibrationRefinement
+{
+public:
+  // pyramid_levels - 1 blurred copies of every edge image are made for search()
+  CalibrationRefinement(unsigned _pyramid_levels = 1, Similarity::Criteria _criteria = Similarity::CC) :
+      pyramid_levels(std::max(_pyramid_levels, 1u)), criteria(_criteria), evaluations(0)
+  {
+  }
+
+  /*
+   * edges: CV_8UC1 IDT edge image, scan: thresholded, P: CV_32FC1 3 x 4
+   */
+  void addFrame(const cv::Mat &edges, Velodyne::Velodyne &scan, const cv::Mat &P)
+  {
+    ROS_ASSERT(edges.type() == CV_8UC1);
+    ROS_ASSERT(P.type() == CV_32FC1 && P.rows == 3 && P.cols == 4);
+
+    frames.push_back(Frame());
+    Frame &frame = frames.back();
+    frame.pyramid.push_back(edges);
+    for (unsigned level = 1; level < pyramid_levels; level++)
+    {
+      cv::Mat blurred;
+      cv::GaussianBlur(edges, blurred, cv::Size(0, 0), 1 << level);
+      frame.pyramid.push_back(blurred);
+    }
+
+    for (int r = 0; r < 3; r++)
+    {
+      for (int c = 0; c < 4; c++)
+      {
+        frame.projection(r, c) = P.at<float>(r, c);
+      }
+    }
+
+    size_t n = scan.size();
+    frame.x.resize(n);
+    frame.y.resize(n);
+    frame.z.resize(n);
+    frame.intensity.resize(n);
+    ::pcl::PointCloud<Velodyne::Point>::iterator pt = scan.begin();
+    for (size_t i = 0; i < n; i++, pt++)
+    {
+      frame.x[i] = pt->x;
+      frame.y[i] = pt->y;
+      frame.z[i] = pt->z;
+      frame.intensity[i] = pt->intensity;
+    }
+
+    // intensities for MI: 0 - 255 up to the 95th percentile, which saturates
+    frame.bin.resize(n);
+    if (n > 0)
+    {
+      std::vector<float> sorted(frame.intensity);
+      std::vector<float>::iterator high = sorted.begin() + n * 95 / 100;
+      std::nth_element(sorted.begin(), high, sorted.end());
+      float scale = *high > 0 ? 255 / *high : 0;
+      for (size_t i = 0; i < n; i++)
+      {
+        frame.bin[i] = std::min(frame.intensity[i] * scale, 255.0f);
+      }
+    }
+    frame.xlogx.resize(n + 1);
+    for (size_t k = 0; k <= n; k++)
+    {
+      frame.xlogx[k] = k > 0 ? k * log((double)k) : 0;
+    }
+  }
+
+  size_t getFrames() const
+  {
+    return frames.size();
+  }
+
+  // edge similarity of the scans transformed by DoF
+  float evaluate(float tx, float ty, float tz, float rot_x, float rot_y, float rot_z, unsigned level = 0)
+  {
+    Scratch scratch;
+    float DoF[6] = {tx, ty, tz, rot_x, rot_y, rot_z};
+    float value = score(level, DoF, scratch, frames.size() > 1);
+    evaluations++;
+    return value;
+  }
+
+  // candidates scored since the construction
+  long getEvaluations() const
+  {
+    return evaluations;
+  }
+
+  /*
+   * Scores steps^6 candidates, steps per axis spanning +-max_translation
+   * around the coarse translation and +-max_rotation around no rotation.
+   * best: the best one; average: mean of those better than the coarse one.
+   */
+  void grid(float x_rough, float y_rough, float z_rough, float max_translation, float max_rotation, unsigned steps,
+            Calibration6DoF &best_calibration, Calibration6DoF &average)
+  {
+    std::vector<float> values;
+    float center[6] = {x_rough, y_rough, z_rough, 0, 0, 0};
+    Box box(center, max_translation, max_rotation, steps);
+    gridValues(0, box, values);
+
+    float rough_val = evaluate(x_rough, y_rough, z_rough, 0, 0, 0);
+    best_calibration.set(x_rough, y_rough, z_rough, 0, 0, 0, rough_val);
+
+    int counter = 0;
+    for (size_t k = 0; k < values.size(); k++)
+    {
+      float DoF[6];
+      box.candidate(k, DoF);
+      Calibration6DoF calibration(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5], values[k]);
+      if (values[k] > best_calibration.value)
+      {
+        best_calibration.set(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5], values[k]);
+      }
+      if (values[k] > rough_val)
+      {
+        average += calibration;
+        counter++;
+      }
+    }
+    average /= counter;
+  }
+
+  /*
+   * Coarse-to-fine search in the same box as grid(): the best seeds of a
+   * coarse grid on the most blurred level are refined by Nelder-Mead on
+   * every level down to the edge image itself. Returns the best of them,
+   * or the coarse calibration if none is better.
+   */
+  void search(float x_rough, float y_rough, float z_rough, float max_translation, float max_rotation,
+              const RefinementOptions &options, Calibration6DoF &best_calibration)
+  {
+    float center[6] = {x_rough, y_rough, z_rough, 0, 0, 0};
+    search(center, max_translation, max_rotation, options, best_calibration);
+  }
+
+  // the same around a whole 6DoF, rotation included
+  void search(const float *center, float max_translation, float max_rotation, const RefinementOptions &options,
+              Calibration6DoF &best_calibration)
+  {
+    ROS_ASSERT(max_translation > 0 && max_rotation > 0 && options.coarse_steps > 1);
+    unsigned top = pyramid_levels - 1;
+
+    std::vector<float> values;
+    Box box(center, max_translation, max_rotation, options.coarse_steps);
+    gridValues(top, box, values);
+
+    std::vector<int> order(values.size());
+    for (size_t k = 0; k < order.size(); k++)
+    {
+      order[k] = k;
+    }
+    int seeds = std::min<size_t>(options.seeds, order.size());
+    std::partial_sort(order.begin(), order.begin() + seeds, order.end(), ByValue(values));
+
+    // the box in units of its half size, the tolerances too
+    float scale[6] = {max_translation, max_translation, max_translation, max_rotation, max_rotation, max_rotation};
+    float tolerance[6];
+    for (int a = 0; a < 6; a++)
+    {
+      tolerance[a] = (a < 3 ? options.tolerance_translation : options.tolerance_rotation) / scale[a];
+    }
+
+    // the seeds in parallel, or one after another with the frames in parallel
+    bool by_frame = frames.size() > 1;
+    std::vector<float> found(seeds * 6), found_values(seeds);
+    long local_evaluations = 0;
+#pragma omp parallel reduction(+:local_evaluations) if(!by_frame)
+    {
+      Scratch scratch;
+#pragma omp for schedule(dynamic, 1)
+      for (int s = 0; s < seeds; s++)
+      {
+        float *normalized = &found[s * 6];
+        float DoF[6];
+        box.candidate(order[s], DoF);
+        for (int a = 0; a < 6; a++)
+        {
+          normalized[a] = (DoF[a] - center[a]) / scale[a];
+        }
+        // half of the coarse grid spacing, halved on every level
+        float step = 1.0 / (options.coarse_steps - 1);
+        for (int level = top; level >= 0; level--)
+        {
+          float level_tolerance[6];
+          for (int a = 0; a < 6; a++)
+          {
+            level_tolerance[a] = tolerance[a] * (1 << level);
+          }
+          found_values[s] = nelderMead(level, center, scale, normalized, step, level_tolerance,
+                                       options.max_iterations, by_frame, scratch, local_evaluations);
+          step /= 2;
+        }
+      }
+    }
+    evaluations += local_evaluations;
+
+    float rough_val = evaluate(center[0], center[1], center[2], center[3], center[4], center[5]);
+    best_calibration.set(center[0], center[1], center[2], center[3], center[4], center[5], rough_val);
+    for (int s = 0; s < seeds; s++)
+    {
+      if (found_values[s] > best_calibration.value)
+      {
+        float DoF[6];
+        denormalize(center, scale, &found[s * 6], DoF);
+        best_calibration.set(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5], found_values[s]);
+      }
+    }
+  }
+
+protected:
+  struct FrameScratch
+  {
+    std::vector<float> u, v, w;
+    // flat 256 x 256 joint histogram, cleared again at the touched bins only
+    std::vector<int> joint, histogram_X, histogram_Y, touched;
+  };
+
+  struct Scratch
+  {
+    std::vector<FrameScratch> frames;
+    std::vector<float> values;
+  };
+
+  struct Frame
+  {
+    // pyramid[0] is the edge image, blurred more with every level
+    std::vector<cv::Mat> pyramid;
+    Eigen::Matrix<float, 3, 4, Eigen::DontAlign> projection;
+    std::vector<float> x, y, z, intensity;
+    std::vector<uchar> bin;
+    // k log(k) for the entropies, k up to the number of points
+    std::vector<double> xlogx;
+
+    float score(unsigned level, const Eigen::Affine3f &transformation, Similarity::Criteria criteria,
+                FrameScratch &scratch) const
+    {
+      const cv::Mat &image = pyramid[level];
+      Eigen::Matrix<float, 3, 4> M = projection * transformation.matrix();
+
+      size_t n = x.size();
+      std::vector<float> &u = scratch.u, &v = scratch.v, &w = scratch.w;
+      u.resize(n);
+      v.resize(n);
+      w.resize(n);
+      for (size_t i = 0; i < n; i++)
+      {
+        w[i] = M(2, 0) * x[i] + M(2, 1) * y[i] + M(2, 2) * z[i] + M(2, 3);
+        u[i] = M(0, 0) * x[i] + M(0, 1) * y[i] + M(0, 2) * z[i] + M(0, 3);
+        v[i] = M(1, 0) * x[i] + M(1, 1) * y[i] + M(1, 2) * z[i] + M(1, 3);
+      }
+
+      if (criteria == Similarity::CC)
+      {
+        float CC = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+          if (!(w[i] > 0.0f))
+          {
+            continue;
+          }
+          float col = u[i] / w[i];
+          float row = v[i] / w[i];
+          if (col >= 0 && col < image.cols && row >= 0 && row < image.rows)
+          {
+            CC += image.ptr<uchar>((int)row)[(int)col] * intensity[i];
+          }
+        }
+        return CC;
+      }
+
+      const int INTENSITIES = 256;
+      std::vector<int> &joint = scratch.joint, &histogram_X = scratch.histogram_X, &histogram_Y = scratch.histogram_Y;
+      std::vector<int> &touched = scratch.touched;
+      if (joint.empty())
+      {
+        joint.assign(INTENSITIES * INTENSITIES, 0);
+        histogram_X.assign(INTENSITIES, 0);
+        histogram_Y.assign(INTENSITIES, 0);
+      }
+      touched.clear();
+      int hits = 0;
+      for (size_t i = 0; i < n; i++)
+      {
+        if (!(w[i] > 0.0f))
+        {
+          continue;
+        }
+        float col = u[i] / w[i];
+        float row = v[i] / w[i];
+        if (col >= 0 && col < image.cols && row >= 0 && row < image.rows)
+        {
+          int x_val = image.ptr<uchar>((int)row)[(int)col];
+          int y_val = bin[i];
+          int cell = x_val * INTENSITIES + y_val;
+          if (joint[cell]++ == 0)
+          {
+            touched.push_back(cell);
+          }
+          histogram_X[x_val]++;
+          histogram_Y[y_val]++;
+          hits++;
+        }
+      }
+
+      // H = log(N) - sum(k log(k)) / N over the bins with k of the N values
+      double sum_X = 0, sum_Y = 0, sum_XY = 0;
+      for (int k = 0; k < INTENSITIES; k++)
+      {
+        sum_X += xlogx[histogram_X[k]];
+        sum_Y += xlogx[histogram_Y[k]];
+        histogram_X[k] = histogram_Y[k] = 0;
+      }
+      for (size_t k = 0; k < touched.size(); k++)
+      {
+        sum_XY += xlogx[joint[touched[k]]];
+        joint[touched[k]] = 0;
+      }
+      if (hits == 0)
+      {
+        return 0;
+      }
+      double H_X = xlogx[hits] / hits - sum_X / hits;
+      double H_Y = xlogx[hits] / hits - sum_Y / hits;
+      double H_XY = xlogx[hits] / hits - sum_XY / hits;
+      if (criteria == Similarity::NMI)
+      {
+        return H_XY > 0 ? (H_X + H_Y) / H_XY : 0;
+      }
+      return H_X + H_Y - H_XY;
+    }
+  };
+
+  // candidates of a grid; the values of an axis are summed up step by step, the last axis changes fastest
+  struct Box
+  {
+    std::vector<float> axes[6];
+    unsigned steps;
+
+    Box(const float *center, float max_translation, float max_rotation, unsigned _steps) :
+        steps(_steps)
+    {
+      float min[6];
+      for (int a = 0; a < 6; a++)
+      {
+        min[a] = center[a] - (a < 3 ? max_translation : max_rotation);
+      }
+      float step_transl = max_translation * 2 / (steps - 1);
+      float step_rot = max_rotation * 2 / (steps - 1);
+      for (int a = 0; a < 6; a++)
+      {
+        float value = min[a];
+        for (unsigned i = 0; i < steps; i++)
+        {
+          axes[a].push_back(value);
+          value += a < 3 ? step_transl : step_rot;
+        }
+      }
+    }
+
+    size_t size() const
+    {
+      size_t count = 1;
+      for (int a = 0; a < 6; a++)
+      {
+        count *= steps;
+      }
+      return count;
+    }
+
+    void candidate(size_t k, float *DoF) const
+    {
+      for (int a = 5; a >= 0; a--)
+      {
+        DoF[a] = axes[a][k % steps];
+        k /= steps;
+      }
+    }
+  };
+
+  // best first, the earlier one on a tie
+  struct ByValue
+  {
+    const std::vector<float> &values;
+
+    ByValue(const std::vector<float> &_values) :
+        values(_values)
+    {
+    }
+
+    bool operator()(int a, int b) const
+    {
+      return values[a] > values[b] || (values[a] == values[b] && a < b);
+    }
+  };
+
+  void gridValues(unsigned level, const Box &box, std::vector<float> &values)
+  {
+    int count = box.size();
+    values.resize(count);
+#pragma omp parallel
+    {
+      Scratch scratch;
+#pragma omp for schedule(dynamic, 16)
+      for (int k = 0; k < count; k++)
+      {
+        float DoF[6];
+        box.candidate(k, DoF);
+        values[k] = score(level, DoF, scratch, false);
+      }
+    }
+    evaluations += count;
+  }
+
+  static void denormalize(const float *center, const float *scale, const float *normalized, float *DoF)
+  {
+    for (int a = 0; a < 6; a++)
+    {
+      DoF[a] = center[a] + scale[a] * normalized[a];
+    }
+  }
+
+  /*
+   * Maximizes the score over the normalized DoF, kept in [-1, 1]^6. The
+   * simplex starts at s with the given step along every axis and stops when
+   * it is narrower than the tolerance in all of them. s becomes the best
+   * vertex, its score is returned.
+   */
+  float nelderMead(unsigned level, const float *center, const float *scale, float *s, float step,
+                   const float *tolerance, unsigned max_iterations, bool by_frame, Scratch &scratch,
+                   long &count) const
+  {
+    float simplex[7][6], values[7];
+    for (int v = 0; v < 7; v++)
+    {
+      std::copy(s, s + 6, simplex[v]);
+      if (v > 0)
+      {
+        simplex[v][v - 1] += s[v - 1] + step <= 1 ? step : -step;
+      }
+      values[v] = scoreNormalized(level, center, scale, simplex[v], by_frame, scratch, count);
+    }
+
+    for (unsigned iteration = 0; iteration < max_iterations; iteration++)
+    {
+      // best first
+      for (int v = 1; v < 7; v++)
+      {
+        for (int w = v; w > 0 && values[w] > values[w - 1]; w--)
+        {
+          std::swap(values[w], values[w - 1]);
+          std::swap_ranges(simplex[w], simplex[w] + 6, simplex[w - 1]);
+        }
+      }
+
+      bool converged = true;
+      for (int a = 0; a < 6 && converged; a++)
+      {
+        float lo = simplex[0][a], hi = simplex[0][a];
+        for (int v = 1; v < 7; v++)
+        {
+          lo = std::min(lo, simplex[v][a]);
+          hi = std::max(hi, simplex[v][a]);
+        }
+        converged = hi - lo <= tolerance[a];
+      }
+      if (converged)
+      {
+        break;
+      }
+
+      float centroid[6], reflected[6], trial[6];
+      for (int a = 0; a < 6; a++)
+      {
+        centroid[a] = 0;
+        for (int v = 0; v < 6; v++)
+        {
+          centroid[a] += simplex[v][a] / 6;
+        }
+      }
+      along(centroid, simplex[6], -1.0f, reflected);
+      float reflected_value = scoreNormalized(level, center, scale, reflected, by_frame, scratch, count);
+
+      if (reflected_value > values[0])
+      {
+        along(centroid, simplex[6], -2.0f, trial);
+        float expanded_value = scoreNormalized(level, center, scale, trial, by_frame, scratch, count);
+        if (expanded_value > reflected_value)
+        {
+          std::copy(trial, trial + 6, simplex[6]);
+          values[6] = expanded_value;
+        }
+        else
+        {
+          std::copy(reflected, reflected + 6, simplex[6]);
+          values[6] = reflected_value;
+        }
+        continue;
+      }
+      if (reflected_value > values[5])
+      {
+        std::copy(reflected, reflected + 6, simplex[6]);
+        values[6] = reflected_value;
+        continue;
+      }
+
+      // contraction, outside of the simplex if the reflection still helped
+      bool outside = reflected_value > values[6];
+      along(centroid, outside ? reflected : simplex[6], 0.5f, trial);
+      float contracted_value = scoreNormalized(level, center, scale, trial, by_frame, scratch, count);
+      if (contracted_value > (outside ? reflected_value : values[6])
+          || (outside && contracted_value == reflected_value))
+      {
+        std::copy(trial, trial + 6, simplex[6]);
+        values[6] = contracted_value;
+        continue;
+      }
+
+      // shrink towards the best vertex
+      for (int v = 1; v < 7; v++)
+      {
+        along(simplex[0], simplex[v], 0.5f, simplex[v]);
+        values[v] = scoreNormalized(level, center, scale, simplex[v], by_frame, scratch, count);
+      }
+    }
+
+    int best = std::max_element(values, values + 7) - values;
+    std::copy(simplex[best], simplex[best] + 6, s);
+    return values[best];
+  }
+
+  // from + t * (to - from), kept in the box
+  static void along(const float *from, const float *to, float t, float *out)
+  {
+    for (int a = 0; a < 6; a++)
+    {
+      out[a] = std::max(-1.0f, std::min(1.0f, from[a] + t * (to[a] - from[a])));
+    }
+  }
+
+  float scoreNormalized(unsigned level, const float *center, const float *scale, const float *normalized,
+                        bool by_frame, Scratch &scratch, long &count) const
+  {
+    float DoF[6];
+    denormalize(center, scale, normalized, DoF);
+    count++;
+    return score(level, DoF, scratch, by_frame);
+  }
+
+  // sum over the frames, in their order; by_frame: the frames in parallel
+  float score(unsigned level, const float *DoF, Scratch &scratch, bool by_frame) const
+  {
+    Eigen::Affine3f transformation = ::pcl::getTransformation(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5]);
+    int count = frames.size();
+    scratch.frames.resize(count);
+    scratch.values.resize(count);
+#pragma omp parallel for schedule(dynamic, 1) if(by_frame)
+    for (int f = 0; f < count; f++)
+    {
+      scratch.values[f] = frames[f].score(level, transformation, criteria, scratch.frames[f]);
+    }
+
+    float CC = 0;
+    for (int f = 0; f < count; f++)
+    {
+      CC += scratch.values[f];
+    }
+    return CC;
+  }
+
+  unsigned pyramid_levels;
+  Similarity::Criteria criteria;
+  std::vector<Frame> frames;
+  long evaluations;
+};
+
 class Calibration
 {
 public:
@@ -183,87 +807,43 @@ public:
     return Calibration6DoF(translation[INDEX::X], translation[INDEX::Y], translation[INDEX::Z], 0, 0, 0, 0);
   }
 
-  static void calibrationRefinement(Image::Image img, Velodyne::Velodyne scan, cv::Mat P, float x_rough, float y_rough,
-                                    float z_rough, float max_translation, float max_rotation, unsigned steps,
-                                    Calibration6DoF &best_calibration, Calibration6DoF &average)
+  /**
+   * Adds a frame to the refinement: the scan with intensities by range
+   * differences, thresholded, and the IDT edge image.
+   */
+  static void addRefinementFrame(CalibrationRefinement &refinement, Image::Image img, Velodyne::Velodyne scan, cv::Mat P)
   {
     scan.intensityByRangeDiff();
-    scan = scan.threshold(0.05);
-
-    img = Image::Image(img.computeIDTEdgeImage());
-
-    float x_min = x_rough - max_translation;
-    float y_min = y_rough - max_translation;
-    float z_min = z_rough - max_translation;
-    float x_rot_min = -max_rotation;
-    float y_rot_min = -max_rotation;
-    float z_rot_min = -max_rotation;
-
-    float step_transl = max_translation * 2 / (steps - 1);
-    float step_rot = max_rotation * 2 / (steps - 1);
-
-    Velodyne::Velodyne transformed = scan.transform(x_rough, y_rough, z_rough, 0, 0, 0);
-    float rough_val = Similarity::edgeSimilarity(img, transformed, P);
-
-    best_calibration.set(x_rough, y_rough, z_rough, 0, 0, 0, rough_val);
-    //cout << "rough:\t";
-    //best_calibration.print();
-
-    int counter = 0;
-
-    float x = x_min;
-    for (size_t xi = 0; xi < steps; xi++)
-    {
-
-      float y = y_min;
-      for (size_t yi = 0; yi < steps; yi++)
-      {
+    scan.threshold(0.05, scan);
 
-        float z = z_min;
-        for (size_t zi = 0; zi < steps; zi++)
-        {
+    refinement.addFrame(img.computeIDTEdgeImage(), scan, P);
+  }
 
-          float x_r = x_rot_min;
-          for (size_t x_ri = 0; x_ri < steps; x_ri++)
-          {
+  static void calibrationRefinement(Image::Image img, Velodyne::Velodyne scan, cv::Mat P, float x_rough, float y_rough,
+                                    float z_rough, float max_translation, float max_rotation, unsigned steps,
+                                    Calibration6DoF &best_calibration, Calibration6DoF &average,
+                                    Similarity::Criteria criteria = Similarity::CC)
+  {
+    CalibrationRefinement refinement(1, criteria);
+    addRefinementFrame(refinement, img, scan, P);
+    refinement.grid(x_rough, y_rough, z_rough, max_translation, max_rotation, steps, best_calibration, average);
+    ROS_INFO_STREAM("Grid refinement: " << refinement.getEvaluations() << " evaluations, score " << best_calibration.value);
+  }
 
-            float y_r = y_rot_min;
-            for (size_t y_ri = 0; y_ri < steps; y_ri++)
-            {
-
-              float z_r = z_rot_min;
-              for (size_t z_ri = 0; z_ri < steps; z_ri++)
-              {
-
-                Velodyne::Velodyne transformed = scan.transform(x, y, z, x_r, y_r, z_r);
-                float value = Similarity::edgeSimilarity(img, transformed, P);
-                Calibration6DoF calibration(x, y, z, x_r, y_r, z_r, value);
-                if (value > best_calibration.value)
-                {
-                  best_calibration.set(x, y, z, x_r, y_r, z_r, value);
-                }
-
-                if (value > rough_val)
-                {
-                  average += calibration;
-                  counter++;
-                }
-                //cout << counter << ".\t";
-                //calibration.print();
-
-                z_r += step_rot;
-              }
-              y_r += step_rot;
-            }
-            x_r += step_rot;
-          }
-          z += step_transl;
-        }
-        y += step_transl;
-      }
-      x += step_transl;
-    }
-    average /= counter;
+  /**
+   * Coarse-to-fine alternative of calibrationRefinement(), see CalibrationRefinement::search().
+   */
+  static Calibration6DoF calibrationRefinementCoarseToFine(Image::Image img, Velodyne::Velodyne scan, cv::Mat P,
+                                                           float x_rough, float y_rough, float z_rough,
+                                                           float max_translation, float max_rotation,
+                                                           const RefinementOptions &options)
+  {
+    CalibrationRefinement refinement(options.pyramid_levels, options.criteria);
+    addRefinementFrame(refinement, img, scan, P);
+    Calibration6DoF best_calibration;
+    refinement.search(x_rough, y_rough, z_rough, max_translation, max_rotation, options, best_calibration);
+    ROS_INFO_STREAM("Coarse-to-fine refinement: " << refinement.getEvaluations() << " evaluations, score " << best_calibration.value);
+    return best_calibration;
   }
 
 };
@@ -11,6 +11,8 @@
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <stdint.h>
+#include <unordered_map>
 
 #include "opencv2/opencv.hpp"
 
@@ -30,6 +32,34 @@
 namespace but_calibration_camera_velodyne
 {
 
+/*
+ * Points of a cloud bucketed by cubic cells, the indexes of every cell
+ * stored contiguously.
+ */
+class PointHash
+{
+public:
+	PointHash(float _cell_size);
+
+	void build(const ::pcl::PointCloud< ::pcl::PointXYZ > &cloud);
+
+	// appends the points of all cells touching the cube of half size radius around center
+	void candidates(const ::pcl::PointXYZ &center, float radius, std::vector<int> &indexes) const;
+
+protected:
+	int cell(float coordinate) const {
+		return (int)floor(coordinate / cell_size);
+	}
+	static int64_t key(int x, int y, int z){
+		return ((int64_t)(x & 0x1FFFFF) << 42) | ((int64_t)(y & 0x1FFFFF) << 21) | (int64_t)(z & 0x1FFFFF);
+	}
+
+	float cell_size;
+	std::vector<int> indexes;
+	// [first, last) of the cell in indexes
+	std::unordered_map<int64_t, std::pair<int, int> > cells;
+};
+
 class Calibration3DMarker
 {
 
@@ -52,7 +82,14 @@ protected:
 			::pcl::copyPointCloud< ::pcl::PointXYZ >(cloud_in, outliers_indicies, cloud_out);
 		}
 	
-	std::vector< ::pcl::PointXYZ > detect4spheres(::pcl::PointCloud< ::pcl::PointXYZ >::Ptr plane, std::vector<float> &radiuses);
+	/*
+	 * Sphere hypotheses from random point triples, generated and scored in
+	 * parallel in batches. Stops at the first batch after which 4 of the
+	 * best distinct spheres form the marker, otherwise returns (at most) 4
+	 * best distinct ones. The same round gives the same hypotheses.
+	 */
+	std::vector< ::pcl::PointXYZ > detect4spheres(const ::pcl::PointCloud< ::pcl::PointXYZ > &cloud, const PointHash &hash,
+	                                              unsigned round, std::vector<float> &radiuses);
 	/*
 	 * Indexes of circles in marker:
 	 * 0 1
@@ -70,7 +107,7 @@ protected:
 	std::vector< ::pcl::PointXYZ > generate_possible_centers(const std::vector< ::pcl::PointXYZ > &spheres_centers,
 												   float straight_distance);
 
-	void generate_possible_points(::pcl::PointCloud< ::pcl::PointXYZ > &plane, ::pcl::PointCloud< ::pcl::PointXYZ >::Ptr detection_cloud, const std::vector< ::pcl::PointXYZ > &possible_centers, float radius, float tolerance);
+	void generate_possible_points(::pcl::PointCloud< ::pcl::PointXYZ > &plane, const PointHash &plane_hash, ::pcl::PointCloud< ::pcl::PointXYZ >::Ptr detection_cloud, const std::vector< ::pcl::PointXYZ > &possible_centers, float radius, float tolerance);
 
 	std::vector< ::pcl::PointXYZ > refine4centers(std::vector< ::pcl::PointXYZ > centers, ::pcl::PointCloud< ::pcl::PointXYZ >::Ptr detection_cloud);
 
@@ -82,6 +119,8 @@ protected:
 	
 	static const int CANNY_THRESH = 150;
 	static const int CENTER_THRESH_DISTANCE = 80;
+	static const int SPHERE_BATCH = 256;
+	static const int SPHERE_BATCHES = 8;
 };
 
 };
@@ -11,6 +11,7 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <vector>
+#include <algorithm>
 
 namespace but_calibration_camera_velodyne
 {
@@ -57,7 +58,8 @@ public:
     {
       for (int col = 0; col <= 1; col++)
       {
-        cv::Vec3b c = rgb.at<cv::Vec3b>(cv::Point(x + col, y + row));
+        // the last column and row repeated at the border
+        cv::Vec3b c = rgb.at<cv::Vec3b>(cv::Point(std::min(x + col, rgb.cols - 1), std::min(y + row, rgb.rows - 1)));
         for (int i = 0; i < 3; i++)
         {
           color_i.val[i] += c.val[i];
@@ -101,19 +101,19 @@ public:
   {
 
     cv::Rect frame(cv::Point(0, 0), segmentation.size());
+    infant_utils::BatchProjection projection;
     int total_miss = 0;
     int total = 0;
     for (int i = 0; i < 2; i++)
     {
       int fire = 0;
       int miss = 0;
-      for (::pcl::PointCloud<Velodyne::Point>::iterator pt = segments[i].begin(); pt < segments[i].end(); pt++)
+      segments[i].project(P, frame, projection);
+      for (size_t k = 0; k < projection.size(); k++)
       {
-        cv::Point xy = Velodyne::Velodyne::project(*pt, P);
-
-        if (pt->z > 0 && xy.inside(frame))
+        if (projection.visible(k))
         {
-          if (segmentation.at<uchar>(xy) == i)
+          if (segmentation.at<uchar>(projection.row(k), projection.col(k)) == i)
           {
             fire++;
           }
@@ -144,15 +144,15 @@ public:
 
   float static edgeSimilarity(Image::Image &img, Velodyne::Velodyne &scan, cv::Mat &P)
   {
-    cv::Rect frame(cv::Point(0, 0), img.size());
+    infant_utils::BatchProjection projection;
+    scan.project(P, cv::Rect(cv::Point(0, 0), img.size()), projection);
     float CC = 0;
-    for (::pcl::PointCloud<Velodyne::Point>::iterator pt = scan.begin(); pt < scan.end(); pt++)
+    ::pcl::PointCloud<Velodyne::Point>::iterator pt = scan.begin();
+    for (size_t i = 0; i < projection.size(); i++, pt++)
     {
-      cv::Point xy = Velodyne::Velodyne::project(*pt, P);
-
-      if (pt->z > 0 && xy.inside(frame))
+      if (projection.visible(i))
       {
-        CC += img.at(xy) * pt->intensity;
+        CC += img.at(cv::Point(projection.col(i), projection.row(i))) * pt->intensity;
       }
     }
     return CC;
@@ -18,6 +18,8 @@
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <pcl/visualization/pcl_visualizer.h>
 
+#include <infant_utils/batch_projection.h>
+
 namespace but_calibration_camera_velodyne {
 
 namespace Velodyne
@@ -41,37 +43,19 @@ struct Point
 class Velodyne
 {
 public:
-  Velodyne()
+  Velodyne() :
+      rings_indexed(false)
   {
   }
   Velodyne(::pcl::PointCloud<Point> point_cloud);
   Velodyne transform(float x, float y, float z, float rot_x, float rot_y, float rot_z);
   Velodyne transform(std::vector<float> DoF);
+  // into out, which may be this scan; the buffers of out are reused
+  void transform(float x, float y, float z, float rot_x, float rot_y, float rot_z, Velodyne &out) const;
+  void transform(const std::vector<float> &DoF, Velodyne &out) const;
 
-  static cv::Point2f projectf(const Point &pt, const cv::Mat &projection_matrix)
-  {
-    cv::Mat pt_3D(4, 1, CV_32FC1);
-
-    pt_3D.at<float>(0) = pt.x;
-    pt_3D.at<float>(1) = pt.y;
-    pt_3D.at<float>(2) = pt.z;
-    pt_3D.at<float>(3) = 1.0f; // is homogenious coords. the point's 4. coord is 1
-
-    cv::Mat pt_2D = projection_matrix * pt_3D;
-
-    float w = pt_2D.at<float>(2);
-    float x = pt_2D.at<float>(0) / w;
-    float y = pt_2D.at<float>(1) / w;
-
-    return cv::Point2f(x, y);
-  }
-
-  static cv::Point project(const Point &pt, const cv::Mat &projection_matrix)
-  {
-
-    cv::Point2f xy = projectf(pt, projection_matrix);
-    return cv::Point(xy.x, xy.y);
-  }
+  // all points at once; projection.visible(i) is point i inside the frame
+  void project(const cv::Mat &projection_matrix, cv::Rect frame, infant_utils::BatchProjection &projection) const;
 
   // cv::Mat project(cv::Mat projection_matrix, cv::Rect frame, ::pcl::PointCloud<Point> *visible_points = NULL, std::vector<int>);
   cv::Mat project(cv::Mat projection_matrix, cv::Rect frame, ::pcl::PointCloud<Point> *visible_points = NULL, std::vector<int> *index = NULL);
@@ -99,6 +83,7 @@ public:
   void push_back(Point pt)
   {
     point_cloud.push_back(pt);
+    rings_indexed = false;
   }
 
   void save(std::string filename)
@@ -157,17 +142,32 @@ public:
   }
 
   ::pcl::PointCloud<pcl::PointXYZRGB> colour(cv::Mat frame_rgb, cv::Mat P);
+  void colour(cv::Mat frame_rgb, cv::Mat P, ::pcl::PointCloud<pcl::PointXYZRGB> &color_cloud) const;
 
   void detectPlanes(cv::Mat projection);
   Velodyne threshold(float thresh);
+  // into out, which may be this scan
+  void threshold(float thresh, Velodyne &out) const;
   void normalizeIntensity(float min = 0.0, float max = 1.0);
   ::pcl::PointCloud<pcl::PointXYZ> *toPointsXYZ();
 
   static const unsigned RINGS_COUNT = 32;
-  std::vector<std::vector<Point*> > getRings();
+  /*
+   * Compressed ring index: the points of ring r are
+   * point_cloud[ringIndex()[i]] for i in [ringOffsets()[r], ringOffsets()[r + 1]),
+   * in the order of the scan.
+   */
+  const std::vector<int> &ringOffsets();
+  const std::vector<int> &ringIndex();
 
 protected:
+  // ring index and ranges, in one pass
+  void indexRings();
+
   ::pcl::PointCloud<Point> point_cloud;
+  std::vector<int> ring_offsets;
+  std::vector<int> ring_index;
+  bool rings_indexed;
 };
 
 } /* NAMESPACE Velodyne */
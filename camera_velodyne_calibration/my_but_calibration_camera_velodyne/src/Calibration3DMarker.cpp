@@ -16,6 +16,56 @@ using namespace ros;
 
 namespace but_calibration_camera_velodyne {
 
+// the circles of the marker as spheres
+static const float SPHERE_RADIUS_MIN = 0.08;
+static const float SPHERE_RADIUS_MAX = 0.09;
+static const float SPHERE_TOLERANCE = 0.02;
+static const int SPHERE_MIN_INLIERS = 5;
+// best distinct spheres tried as the marker
+static const int SPHERE_CANDIDATES = 8;
+static const float MARKER_TOLERANCE = 0.03; // 3cm
+
+PointHash::PointHash(float _cell_size) :
+    cell_size(_cell_size)
+{
+}
+
+void PointHash::build(const PointCloud<PointXYZ> &cloud){
+	vector<pair<int64_t, int> > keyed(cloud.size());
+	for (size_t i = 0; i < cloud.size(); i++){
+		const PointXYZ &pt = cloud.points[i];
+		keyed[i] = make_pair(key(cell(pt.x), cell(pt.y), cell(pt.z)), (int)i);
+	}
+	sort(keyed.begin(), keyed.end());
+
+	indexes.resize(keyed.size());
+	cells.clear();
+	for (size_t first = 0; first < keyed.size();){
+		size_t last = first;
+		for (; last < keyed.size() && keyed[last].first == keyed[first].first; last++){
+			indexes[last] = keyed[last].second;
+		}
+		cells[keyed[first].first] = make_pair((int)first, (int)last);
+		first = last;
+	}
+}
+
+void PointHash::candidates(const PointXYZ &center, float radius, vector<int> &out) const{
+	int x0 = cell(center.x - radius), x1 = cell(center.x + radius);
+	int y0 = cell(center.y - radius), y1 = cell(center.y + radius);
+	int z0 = cell(center.z - radius), z1 = cell(center.z + radius);
+	for (int x = x0; x <= x1; x++){
+		for (int y = y0; y <= y1; y++){
+			for (int z = z0; z <= z1; z++){
+				unordered_map<int64_t, pair<int, int> >::const_iterator c = cells.find(key(x, y, z));
+				if (c != cells.end()){
+					out.insert(out.end(), indexes.begin() + c->second.first, indexes.begin() + c->second.second);
+				}
+			}
+		}
+	}
+}
+
 Calibration3DMarker::Calibration3DMarker(cv::Mat _frame_gray, cv::Mat _P, ::PointCloud<Velodyne::Point> _pc, float _circ_distance, float _radius) :
     frame_gray(_frame_gray), P(_P), pc(_pc), circ_distance(_circ_distance), radius(_radius)
 	{
@@ -23,16 +73,15 @@ Calibration3DMarker::Calibration3DMarker(cv::Mat _frame_gray, cv::Mat _P, ::Poin
 	// ---------------- GET PLANE ----------------
 
 	Velodyne::Velodyne scan(pc);
-	scan.getRings();
 	scan.intensityByRangeDiff();
 	PointCloud<Velodyne::Point> visible_cloud;
 	scan.project(P, Rect(0, 0, 640, 480), &visible_cloud);
 
 	Velodyne::Velodyne visible_scan(visible_cloud);
 	visible_scan.normalizeIntensity();
-	Velodyne::Velodyne thresholded_scan = visible_scan.threshold(0.1);
+	visible_scan.threshold(0.1, visible_scan);
 
-	PointCloud<PointXYZ>::Ptr xyz_cloud_ptr(thresholded_scan.toPointsXYZ());
+	PointCloud<PointXYZ>::Ptr xyz_cloud_ptr(visible_scan.toPointsXYZ());
 
 	SampleConsensusModelPlane<PointXYZ>::Ptr model_p (new ::SampleConsensusModelPlane<PointXYZ>(xyz_cloud_ptr));
 	RandomSampleConsensus<PointXYZ> ransac(model_p);
@@ -77,15 +126,21 @@ bool Calibration3DMarker::detectCirclesInPointCloud(vector<Point3f> &centers, ve
 	PointCloud<PointXYZ>::Ptr detection_cloud(new PointCloud<PointXYZ>);
 	*detection_cloud += this->plane;
 
-	float tolerance = 0.03; // 3cm
+	// cells of the sphere diameter, the neighbourhood of a sphere is 3x3x3 cells
+	PointHash plane_hash(2 * SPHERE_RADIUS_MAX);
+	plane_hash.build(this->plane);
+	PointHash detection_hash(2 * SPHERE_RADIUS_MAX);
+
+	float tolerance = MARKER_TOLERANCE;
 	int round = 1;
 	vector<PointXYZ> spheres_centers;
 	bool detected = false;
-	for (int iterations = 0; iterations < 64; iterations++){
+	for (int iterations = 0; iterations < 64 && !detection_cloud->empty(); iterations++){
 		/*cerr << endl << " =========== ROUND " << round++ << " =========== "
 		 << endl << endl;
 		 cerr << "detection_cloud size: " << detection_cloud->size() << endl;*/
-		spheres_centers = detect4spheres(detection_cloud, radiuses);
+		detection_hash.build(*detection_cloud);
+		spheres_centers = detect4spheres(*detection_cloud, detection_hash, iterations, radiuses);
 
 		if (spheres_centers.size() == 4){
 			order4spheres(spheres_centers);
@@ -100,7 +155,7 @@ bool Calibration3DMarker::detectCirclesInPointCloud(vector<Point3f> &centers, ve
 			}
 		}
 		vector<PointXYZ> possible_centers = generate_possible_centers(spheres_centers, this->circ_distance);
-		generate_possible_points(this->plane, detection_cloud, possible_centers, this->circ_distance, 0.01);
+		generate_possible_points(this->plane, plane_hash, detection_cloud, possible_centers, this->circ_distance, 0.01);
 	}
 
 	if (!detected){
@@ -113,45 +168,141 @@ bool Calibration3DMarker::detectCirclesInPointCloud(vector<Point3f> &centers, ve
 	return true;
 }
 
-vector<PointXYZ> Calibration3DMarker::detect4spheres(PointCloud<PointXYZ>::Ptr plane, vector<float> &radiuses){
+struct SphereHypothesis
+{
+	PointXYZ center;
+	float radius;
+	int inliers;
+};
+
+bool orderInliers(const SphereHypothesis &h1, const SphereHypothesis &h2){
+	return h1.inliers > h2.inliers;
+}
+
+// xorshift32, state must not be 0
+static uint32_t nextRandom(uint32_t &state){
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+// the smallest sphere through a, b, c - its center lies in their plane
+static bool sphereThrough(const PointXYZ &a, const PointXYZ &b, const PointXYZ &c, PointXYZ &center, float &radius){
+	Eigen::Vector3f pa(a.x, a.y, a.z);
+	Eigen::Vector3f ab = Eigen::Vector3f(b.x, b.y, b.z) - pa;
+	Eigen::Vector3f ac = Eigen::Vector3f(c.x, c.y, c.z) - pa;
+	Eigen::Vector3f n = ab.cross(ac);
+	float n2 = n.squaredNorm();
+	if (n2 < 1e-10){
+		return false;
+	}
+	Eigen::Vector3f offset = (ac.squaredNorm() * n.cross(ab) + ab.squaredNorm() * ac.cross(n)) / (2 * n2);
+	center = PointXYZ(pa.x() + offset.x(), pa.y() + offset.y(), pa.z() + offset.z());
+	radius = offset.norm();
+	return true;
+}
+
+static SphereHypothesis sphereHypothesis(const PointCloud<PointXYZ> &cloud, const PointHash &hash, uint32_t state,
+										 vector<int> &neighbours){
+	SphereHypothesis hypothesis;
+	hypothesis.inliers = 0;
+
+	// the other two points near enough to share a circle with the first one
+	const PointXYZ &a = cloud.points[nextRandom(state) % cloud.size()];
+	neighbours.clear();
+	hash.candidates(a, 2 * SPHERE_RADIUS_MAX, neighbours);
+	const PointXYZ &b = cloud.points[neighbours[nextRandom(state) % neighbours.size()]];
+	const PointXYZ &c = cloud.points[neighbours[nextRandom(state) % neighbours.size()]];
+	if (!sphereThrough(a, b, c, hypothesis.center, hypothesis.radius) ||
+		hypothesis.radius < SPHERE_RADIUS_MIN || hypothesis.radius > SPHERE_RADIUS_MAX){
+		return hypothesis;
+	}
+
+	neighbours.clear();
+	hash.candidates(hypothesis.center, hypothesis.radius + SPHERE_TOLERANCE, neighbours);
+	for (vector<int>::iterator i = neighbours.begin(); i < neighbours.end(); i++){
+		const PointXYZ &pt = cloud.points[*i];
+		float dx = pt.x - hypothesis.center.x, dy = pt.y - hypothesis.center.y, dz = pt.z - hypothesis.center.z;
+		if (fabs(sqrt(dx * dx + dy * dy + dz * dz) - hypothesis.radius) < SPHERE_TOLERANCE){
+			hypothesis.inliers++;
+		}
+	}
+	return hypothesis;
+}
+
+vector<PointXYZ> Calibration3DMarker::detect4spheres(const PointCloud<PointXYZ> &cloud, const PointHash &hash,
+													 unsigned round, vector<float> &radiuses){
 
 	radiuses.clear();
 	vector<PointXYZ> centers;
-	std::vector<int> inliers_indicies;
-	PointCloud<PointXYZ> *four_spheres = new PointCloud<PointXYZ>();
-	float tolerance = 0.02;
-	for (int i = 0; i < 4; i++){
-		SampleConsensusModelSphere<PointXYZ>::Ptr model_s(new SampleConsensusModelSphere<PointXYZ>(plane));
-		model_s->setRadiusLimits(0.08, 0.09);
-		RandomSampleConsensus<PointXYZ> ransac_sphere(model_s);
-		ransac_sphere.setDistanceThreshold(tolerance);
-		ransac_sphere.computeModel();
-		inliers_indicies.clear();
-		ransac_sphere.getInliers(inliers_indicies);
-
-		if (inliers_indicies.size() == 0){
-			continue;
+	if (cloud.empty()){
+		return centers;
+	}
+
+	vector<SphereHypothesis> batch(SPHERE_BATCH);
+	vector<SphereHypothesis> found;
+	vector<SphereHypothesis> distinct;
+	float min_distance = this->circ_distance / 2;
+	for (int b = 0; b < SPHERE_BATCHES; b++){
+#pragma omp parallel
+		{
+			vector<int> neighbours;
+#pragma omp for schedule(dynamic, 16)
+			for (int h = 0; h < SPHERE_BATCH; h++){
+				// seeded by the hypothesis, not by the thread
+				uint32_t state = ((round * SPHERE_BATCHES + b) * SPHERE_BATCH + h + 1) * 2654435761u;
+				batch[h] = sphereHypothesis(cloud, hash, state ? state : 1, neighbours);
+			}
+		}
+		for (int h = 0; h < SPHERE_BATCH; h++){
+			if (batch[h].inliers >= SPHERE_MIN_INLIERS){
+				found.push_back(batch[h]);
+			}
+		}
+		stable_sort(found.begin(), found.end(), orderInliers);
+
+		// the same circle is found by many hypotheses
+		distinct.clear();
+		for (vector<SphereHypothesis>::iterator s = found.begin(); s < found.end() && distinct.size() < SPHERE_CANDIDATES; s++){
+			bool far = true;
+			for (vector<SphereHypothesis>::iterator d = distinct.begin(); d < distinct.end() && far; d++){
+				float dx = s->center.x - d->center.x, dy = s->center.y - d->center.y, dz = s->center.z - d->center.z;
+				far = dx * dx + dy * dy + dz * dz > min_distance * min_distance;
+			}
+			if (far){
+				distinct.push_back(*s);
+			}
+		}
+
+		int n = distinct.size();
+		for (int i = 0; i < n; i++){
+			for (int j = i + 1; j < n; j++){
+				for (int k = j + 1; k < n; k++){
+					for (int l = k + 1; l < n; l++){
+						int quad[4] = {i, j, k, l};
+						vector<PointXYZ> ordered;
+						for (int q = 0; q < 4; q++){
+							ordered.push_back(distinct[quad[q]].center);
+						}
+						order4spheres(ordered);
+						if (verify4spheres(ordered, this->circ_distance, MARKER_TOLERANCE)){
+							for (int q = 0; q < 4; q++){
+								centers.push_back(distinct[quad[q]].center);
+								radiuses.push_back(distinct[quad[q]].radius);
+							}
+							return centers;
+						}
+					}
+				}
+			}
 		}
-		Eigen::VectorXf coeficients;
-		ransac_sphere.getModelCoefficients(coeficients);
-		//cerr << i + 1 << ". circle: " << coeficients << endl << endl;
-
-		PointCloud<PointXYZ>::Ptr outliers(new PointCloud<PointXYZ>);
-		PointCloud<PointXYZ>::Ptr inliers(new PointCloud<PointXYZ>);
-		remove_inliers<PointXYZ>(*plane, inliers_indicies, *outliers);
-		copyPointCloud<PointXYZ>(*plane, inliers_indicies, *inliers);
-		plane = outliers;
-		//view(plane);
-
-		*four_spheres += *inliers;
-		PointXYZ middle(coeficients(0), coeficients(1), coeficients(2));
-		four_spheres->push_back(middle);
-		centers.push_back(middle);
-
-		float radius = coeficients(3);
-		radiuses.push_back(radius);
 	}
-	PointCloud<PointXYZ>::Ptr four_spheres_ptr(four_spheres);
+
+	for (size_t i = 0; i < distinct.size() && i < 4; i++){
+		centers.push_back(distinct[i].center);
+		radiuses.push_back(distinct[i].radius);
+	}
 	return centers;
 }
 
@@ -224,18 +375,25 @@ vector<PointXYZ> Calibration3DMarker::generate_possible_centers(const vector<Poi
 	return possible_centers;
 }
 
-void Calibration3DMarker::generate_possible_points(PointCloud<PointXYZ> &plane, PointCloud<PointXYZ>::Ptr detection_cloud, const vector<PointXYZ> &possible_centers, float radius, float tolerance){
+void Calibration3DMarker::generate_possible_points(PointCloud<PointXYZ> &plane, const PointHash &plane_hash, PointCloud<PointXYZ>::Ptr detection_cloud, const vector<PointXYZ> &possible_centers, float radius, float tolerance){
 
-	detection_cloud->clear();
-	for (PointCloud<PointXYZ>::iterator pt = plane.begin(); pt < plane.end(); pt++){
-		int votes = 0;
-		for (vector<PointXYZ>::const_iterator center = possible_centers.begin(); center < possible_centers.end(); center++){
-			if (euclid_dist(*pt, *center) < radius + tolerance){
-				votes++;
+	vector<char> votes(plane.size(), 0);
+	vector<int> candidates;
+	for (vector<PointXYZ>::const_iterator center = possible_centers.begin(); center < possible_centers.end(); center++){
+		candidates.clear();
+		plane_hash.candidates(*center, radius + tolerance, candidates);
+		for (vector<int>::iterator i = candidates.begin(); i < candidates.end(); i++){
+			if (!votes[*i] && euclid_dist(plane.points[*i], *center) < radius + tolerance){
+				votes[*i] = 1;
 			}
 		}
-		if (votes > 0){
-			detection_cloud->push_back(*pt);
+	}
+
+	// in the order of the plane
+	detection_cloud->clear();
+	for (size_t i = 0; i < plane.size(); i++){
+		if (votes[i]){
+			detection_cloud->push_back(plane.points[i]);
 		}
 	}
 }
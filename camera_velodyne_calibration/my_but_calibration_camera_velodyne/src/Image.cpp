@@ -9,6 +9,7 @@
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include <algorithm>
+#include <cstdlib>
 
 using namespace std;
 using namespace cv;
@@ -75,6 +76,137 @@ Mat Image::computeEdgeImage()
   return edges;
 }
 
+/*
+ * The inverse distance transform is done line by line, first through the
+ * rows and then through the cols. Pixel x of a line takes the source j with
+ * the largest min(distance_weights[|x - j|], weights[j]) * edges[j] (the first
+ * one on a tie), that value and the weight it was taken with. The values are
+ * computed with the same float expressions as the full scan of every line,
+ * so near ties are decided exactly as before; a max tree over the sources
+ * of the line (the largest edges[j] and weights[j] * edges[j] below every
+ * node, leaves padded with zeros) only prunes the ones that cannot win.
+ *
+ * This is not linear. Building a line's tree is O(n) and a pixel usually
+ * costs O(log n), as the source of x - 1 bounds away all but one path, but
+ * sources that tie up to rounding all have to be evaluated: O(n) per pixel
+ * and O(n^2) per line in the worst case, as for the full scan. Along a
+ * diagonal edge the cols pass gets such a tie from every pixel of the edge.
+ */
+struct IDTTree
+{
+  int n, leaves;
+  vector<float> edge_max, top_max;
+};
+
+static void idtSet(IDTTree &tree, int j, float edge, float weight)
+{
+  int node = tree.leaves + j;
+  tree.edge_max[node] = edge;
+  tree.top_max[node] = weight * edge;
+  for (node /= 2; node > 0; node /= 2)
+  {
+    tree.edge_max[node] = std::max(tree.edge_max[2 * node], tree.edge_max[2 * node + 1]);
+    tree.top_max[node] = std::max(tree.top_max[2 * node], tree.top_max[2 * node + 1]);
+  }
+}
+
+static void idtBuild(IDTTree &tree, const float *edges, const float *weights, int n)
+{
+  tree.n = n;
+  tree.leaves = 1;
+  while (tree.leaves < n)
+  {
+    tree.leaves *= 2;
+  }
+  tree.edge_max.assign(2 * tree.leaves, 0.0f);
+  tree.top_max.assign(2 * tree.leaves, 0.0f);
+  for (int j = 0; j < n; j++)
+  {
+    tree.edge_max[tree.leaves + j] = edges[j];
+    tree.top_max[tree.leaves + j] = weights[j] * edges[j];
+  }
+  for (int node = tree.leaves - 1; node > 0; node--)
+  {
+    tree.edge_max[node] = std::max(tree.edge_max[2 * node], tree.edge_max[2 * node + 1]);
+    tree.top_max[node] = std::max(tree.top_max[2 * node], tree.top_max[2 * node + 1]);
+  }
+}
+
+/*
+ * Sources of [lo, hi] seen from x. No value below a node can exceed
+ * min(dw[distance] * edge_max, top_max), rounding included, so a node is
+ * skipped when that bound cannot beat the best one so far or tie with it
+ * at a lower index. Among zeros the first pixel wins, which is set after.
+ */
+static void idtSearch(const IDTTree &tree, const float *dw, const float *edges, const float *weights, int x,
+                      int node, int lo, int hi, float &best, int &best_j)
+{
+  if (lo >= tree.n)
+  {
+    return;
+  }
+  int d = x < lo ? lo - x : (x > hi ? x - hi : 0);
+  float bound = std::min(dw[d] * tree.edge_max[node], tree.top_max[node]);
+  if (bound < best || (bound == best && (lo > best_j || best == 0.0f)))
+  {
+    return;
+  }
+  if (lo == hi)
+  {
+    float value = std::min(dw[std::abs(x - lo)], weights[lo]) * edges[lo];
+    if (value > best || (value == best && lo < best_j))
+    {
+      best = value;
+      best_j = lo;
+    }
+    return;
+  }
+  // the half nearer to x first, it sets a high best early
+  int mid = (lo + hi) / 2;
+  if (x <= mid)
+  {
+    idtSearch(tree, dw, edges, weights, x, 2 * node, lo, mid, best, best_j);
+    idtSearch(tree, dw, edges, weights, x, 2 * node + 1, mid + 1, hi, best, best_j);
+  }
+  else
+  {
+    idtSearch(tree, dw, edges, weights, x, 2 * node + 1, mid + 1, hi, best, best_j);
+    idtSearch(tree, dw, edges, weights, x, 2 * node, lo, mid, best, best_j);
+  }
+}
+
+/*
+ * One line. With new_edges == edges and new_weights == weights the line is
+ * done in place, as the cols pass always was: the pixels before x take
+ * part as sources with their results.
+ */
+static void idtLine(const float *dw, float *edges, float *weights, int n, float *new_edges, float *new_weights,
+                    IDTTree &tree)
+{
+  bool in_place = new_edges == edges;
+  idtBuild(tree, edges, weights, n);
+  int last = 0;
+  for (int x = 0; x < n; x++)
+  {
+    // the source of x - 1 is usually the one of x as well, it prunes most of the tree
+    float best = std::min(dw[std::abs(x - last)], weights[last]) * edges[last];
+    int best_j = last;
+    idtSearch(tree, dw, edges, weights, x, 1, 0, tree.leaves - 1, best, best_j);
+    if (best == 0.0f)
+    {
+      best_j = 0;
+    }
+    float weight = std::min(dw[std::abs(x - best_j)], weights[best_j]);
+    new_edges[x] = best;
+    new_weights[x] = weight;
+    last = best_j;
+    if (in_place)
+    {
+      idtSet(tree, x, best, weight);
+    }
+  }
+}
+
 Mat Image::computeIDTEdgeImage(Mat &edge_img)
 {
   Mat edges;
@@ -82,42 +214,38 @@ Mat Image::computeIDTEdgeImage(Mat &edge_img)
 
   Mat default_edges = edges;
 
+  const float *dw = distance_weights.ptr<float>() + distance_weights.cols / 2;
   Mat weights = Mat::ones(edges.size(), CV_32FC1);
-  Mat new_weights = Mat::ones(edges.size(), CV_32FC1);
-  Mat new_edges = Mat::zeros(edges.size(), CV_32FC1);
-
-  int weights_middle = distance_weights.cols / 2;
-  for (int rows_cols = 0; rows_cols < 2; rows_cols++)
+  Mat new_edges(edges.size(), CV_32FC1);
+  Mat new_weights(edges.size(), CV_32FC1);
+#pragma omp parallel
   {
-    // first time through rows, second by cols (is transposed)
-    int width = edges.cols;
+    IDTTree tree;
+#pragma omp for schedule(static)
     for (int row = 0; row < edges.rows; row++)
     {
-      for (int x = 0; x < width; x++)
-      {
-        Mat sub_weights;
-        min(distance_weights(Rect(weights_middle - x, 0, width, 1)), weights.row(row), sub_weights);
-
-        Mat edges_row = edges.row(row);
-
-        Mat sub_res = sub_weights.mul(edges_row);
-
-        double max;
-        Point max_loc;
-        minMaxLoc(sub_res, NULL, &max, NULL, &max_loc);
-
-        new_edges.at<float>(row, x) = max;
-        new_weights.at<float>(row, x) = sub_weights.at<float>(max_loc.x);
-      }
+      idtLine(dw, edges.ptr<float>(row), weights.ptr<float>(row), edges.cols, new_edges.ptr<float>(row),
+              new_weights.ptr<float>(row), tree);
     }
+  }
 
-    new_edges = new_edges.t();
-    new_weights = new_weights.t();
-    edges = new_edges;
-    weights = new_weights;
+  // cols transposed, so the lines stay continuous; in place like the rows results
+  transpose(new_edges, edges);
+  transpose(new_weights, weights);
+#pragma omp parallel
+  {
+    IDTTree tree;
+#pragma omp for schedule(static)
+    for (int col = 0; col < edges.rows; col++)
+    {
+      float *e = edges.ptr<float>(col);
+      float *w = weights.ptr<float>(col);
+      idtLine(dw, e, w, edges.cols, e, w, tree);
+    }
   }
 
-  Mat idt_edge_img = new_edges.mul(new_weights);
+  Mat idt_edge_img = edges.mul(weights);
+  idt_edge_img = idt_edge_img.t();
 
   addWeighted(default_edges, alpha, idt_edge_img, (1.0 - alpha), 0.0, idt_edge_img);
 
@@ -17,19 +17,21 @@ void Similarity::computeEntropies()
 {
   vector<float> histogram_X(INTENSITIES, 0);
   vector<float> histogram_Y(INTENSITIES, 0);
-  map<pair<uchar, uchar>, float> joint_histogram;
+  vector<float> joint_histogram(INTENSITIES * INTENSITIES, 0);
 
   for (int row = 0; row < X.rows; row++)
   {
+    const uchar *x_row = X.ptr<uchar>(row);
+    const uchar *y_row = Y.ptr<uchar>(row);
     for (int col = 0; col < X.cols; col++)
     {
-      uchar x_val = X.at<uchar>(row, col);
-      uchar y_val = Y.at<uchar>(row, col);
+      uchar x_val = x_row[col];
+      uchar y_val = y_row[col];
 
       histogram_X[x_val] += 1;
       histogram_Y[y_val] += 1;
 
-      joint_histogram[pair<uchar, uchar>(x_val, y_val)] += 1;
+      joint_histogram[x_val * INTENSITIES + y_val] += 1;
     }
   }
 
@@ -51,11 +53,13 @@ void Similarity::computeEntropies()
     }
   }
 
-  float points_nm_pow = points_nm * points_nm;
-  for (map<pair<uchar, uchar>, float>::iterator i = joint_histogram.begin(); i != joint_histogram.end(); i++)
+  for (size_t i = 0; i < joint_histogram.size(); i++)
   {
-    p = i->second / points_nm_pow;
-    H_XY = -p * log(p);
+    p = joint_histogram[i] / points_nm;
+    if (p > 0)
+    {
+      H_XY += -p * log(p);
+    }
   }
 }
 
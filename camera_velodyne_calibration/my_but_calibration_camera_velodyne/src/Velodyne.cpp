@@ -24,17 +24,16 @@ using namespace ros;
 namespace but_calibration_camera_velodyne
 {
 Velodyne::Velodyne::Velodyne(PointCloud<Point> _point_cloud) :
-	point_cloud(_point_cloud)
+	point_cloud(_point_cloud), rings_indexed(false)
 {
-	getRings(); // range computation
+	indexRings(); // range computation
 }
 
 Velodyne::Velodyne Velodyne::Velodyne::transform(float x, float y, float z, float rot_x, float rot_y, float rot_z)
 {
-	Eigen::Affine3f transf = getTransformation(x, y, z, rot_x, rot_y, rot_z);
-	PointCloud<Point> new_cloud;
-	transformPointCloud(point_cloud, new_cloud, transf);
-	return Velodyne(new_cloud);
+	Velodyne transformed;
+	transform(x, y, z, rot_x, rot_y, rot_z, transformed);
+	return transformed;
 }
 
 Velodyne::Velodyne Velodyne::Velodyne::transform(vector<float> DoF)
@@ -43,6 +42,31 @@ Velodyne::Velodyne Velodyne::Velodyne::transform(vector<float> DoF)
 	return transform(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5]);
 }
 
+void Velodyne::Velodyne::transform(float x, float y, float z, float rot_x, float rot_y, float rot_z, Velodyne &out) const
+{
+	Eigen::Affine3f transf = getTransformation(x, y, z, rot_x, rot_y, rot_z);
+	if (&out != this)
+	{
+		out = *this;
+	}
+
+	// the order of the points is kept, so is the ring index; the ranges are from the new origin
+	for (PointCloud<Point>::iterator pt = out.point_cloud.points.begin(); pt < out.point_cloud.points.end(); pt++)
+	{
+		Eigen::Vector3f transformed = transf * Eigen::Vector3f(pt->x, pt->y, pt->z);
+		pt->x = transformed.x();
+		pt->y = transformed.y();
+		pt->z = transformed.z();
+		pt->range = transformed.norm();
+	}
+}
+
+void Velodyne::Velodyne::transform(const vector<float> &DoF, Velodyne &out) const
+{
+	ROS_ASSERT(DoF.size() == 6);
+	transform(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5], out);
+}
+
 // Mat Velodyne::Velodyne::project(Mat projection_matrix, Rect frame, PointCloud<Point> *visible_points)
 // {
   // Mat plane = cv::Mat::zeros(frame.size(), CV_32FC1);
@@ -80,34 +104,41 @@ Velodyne::Velodyne Velodyne::Velodyne::transform(vector<float> DoF)
   // return plane_gray;
 // }
 
+void Velodyne::Velodyne::project(const Mat &projection_matrix, Rect frame, infant_utils::BatchProjection &projection) const
+{
+	ROS_ASSERT(projection_matrix.type() == CV_32FC1 && projection_matrix.isContinuous());
+	projection.setMatrix(projection_matrix.ptr<float>());
+	projection.setFrame(frame.x, frame.y, frame.width, frame.height);
+	projection.project(point_cloud);
+}
+
 Mat Velodyne::Velodyne::project(Mat projection_matrix, Rect frame, PointCloud<Point> *visible_points, vector<int> *index)
 {
 	Mat plane = cv::Mat::zeros(frame.size(), CV_32FC1);
 
-	for (PointCloud<Point>::iterator pt = point_cloud.points.begin(); pt < point_cloud.points.end(); pt++)
-	{
+	infant_utils::BatchProjection projection;
+	this->project(projection_matrix, frame, projection);
 
-		// behind the camera
-		if (pt->z < 0)
+	for (size_t i = 0; i < projection.size(); i++)
+	{
+		// behind the camera or outside the frame
+		if (!projection.visible(i))
 		{
 			continue;
 		}
 
-		float intensity = pt->intensity;
-		cv::Point xy = Velodyne::project(*pt, projection_matrix);
-
-		if (xy.inside(frame))
+		const Point &pt = point_cloud.points[i];
+		if (visible_points != NULL)
 		{
-			if (visible_points != NULL)
-			{
-				visible_points->push_back(*pt);
-				index->push_back(distance(point_cloud.points.begin(), pt));
-				// cout<<"index : "<<distance(point_cloud.points.begin(), pt)<<endl;
-			}
-
-			//cv::circle(plane, xy, 3, intensity, -1);
-			plane.at<float>(xy) = intensity;
+			visible_points->push_back(pt);
 		}
+		if (index != NULL)
+		{
+			index->push_back(i);
+		}
+
+		//cv::circle(plane, xy, 3, intensity, -1);
+		plane.at<float>(cv::Point(projection.col(i), projection.row(i))) = pt.intensity;
 	}
 
 	Mat plane_gray;
@@ -135,17 +166,46 @@ Mat Velodyne::Velodyne::project(Mat projection_matrix, Rect frame, Mat image)
 	return result_channel;
 }
 
-vector<vector<Velodyne::Point*> > Velodyne::Velodyne::getRings()
+void Velodyne::Velodyne::indexRings()
 {
-	vector<vector<Point*> > rings(Velodyne::Velodyne::RINGS_COUNT);
+	// counting sort by the ring, stable
+	ring_offsets.assign(RINGS_COUNT + 1, 0);
 	for (PointCloud<Point>::iterator pt = point_cloud.points.begin(); pt < point_cloud.points.end(); pt++)
 	{
 		ROS_ASSERT(pt->ring < RINGS_COUNT);
 		pt->range = sqrt(pt->x * pt->x + pt->y * pt->y + pt->z * pt->z);
+		ring_offsets[pt->ring + 1]++;
+	}
+	for (unsigned ring = 0; ring < RINGS_COUNT; ring++)
+	{
+		ring_offsets[ring + 1] += ring_offsets[ring];
+	}
+
+	ring_index.resize(point_cloud.size());
+	vector<int> next(ring_offsets.begin(), ring_offsets.end() - 1);
+	for (size_t i = 0; i < point_cloud.size(); i++)
+	{
+		ring_index[next[point_cloud.points[i].ring]++] = i;
+	}
+	rings_indexed = true;
+}
+
+const vector<int> &Velodyne::Velodyne::ringOffsets()
+{
+	if (!rings_indexed)
+	{
+		indexRings();
+	}
+	return ring_offsets;
+}
 
-		rings[pt->ring].push_back(&(*pt));
+const vector<int> &Velodyne::Velodyne::ringIndex()
+{
+	if (!rings_indexed)
+	{
+		indexRings();
 	}
-	return rings;
+	return ring_index;
 }
 
 void Velodyne::Velodyne::intensityByRangeDiff()
@@ -159,33 +219,36 @@ void Velodyne::Velodyne::intensityByIntensityDiff()
 
 void Velodyne::Velodyne::intensityByDiff(Processing processing)
 {
-	vector<vector<Point*> > rings = this->getRings();
+	const vector<int> &offsets = ringOffsets();
+	Point *points = point_cloud.points.data();
 
-	for (vector<vector<Point*> >::iterator ring = rings.begin(); ring < rings.end(); ring++)
+	for (unsigned ring = 0; ring < RINGS_COUNT; ring++)
 	{
-		Point* prev, *succ;
-		if (ring->empty())
+		const int *first = ring_index.data() + offsets[ring];
+		const int *last = ring_index.data() + offsets[ring + 1];
+		if (first == last)
 		{
 			continue;
 		}
-		float last_intensity = (*ring->begin())->intensity;
+		float last_intensity = points[*first].intensity;
 		float new_intensity;
-		(*ring->begin())->intensity = 0;
-		(*(ring->end() - 1))->intensity = 0;
-		for (vector<Point*>::iterator pt = ring->begin() + 1; pt < ring->end() - 1; pt++)
+		points[*first].intensity = 0;
+		points[*(last - 1)].intensity = 0;
+		for (const int *i = first + 1; i < last - 1; i++)
 		{
-			prev = *(pt - 1);
-			succ = *(pt + 1);
+			Point &pt = points[*i];
+			const Point &prev = points[*(i - 1)];
+			const Point &succ = points[*(i + 1)];
 
 			switch (processing)
 			{
 				case Processing::DISTORTIONS:
-					(*pt)->intensity = MAX( MAX( prev->range-(*pt)->range, succ->range-(*pt)->range), 0) * 10;
+					pt.intensity = MAX( MAX( prev.range-pt.range, succ.range-pt.range), 0) * 10;
 					break;
 				case Processing::INTENSITY_EDGES:
-					new_intensity = MAX( MAX( last_intensity-(*pt)->intensity, succ->intensity-(*pt)->intensity), 0) * 10;
-					last_intensity = (*pt)->intensity;
-					(*pt)->intensity = new_intensity;
+					new_intensity = MAX( MAX( last_intensity-pt.intensity, succ.intensity-pt.intensity), 0) * 10;
+					last_intensity = pt.intensity;
+					pt.intensity = new_intensity;
 					break;
 				case Processing::NONE:
 					break;
@@ -230,15 +293,31 @@ void Velodyne::Velodyne::normalizeIntensity(float min, float max)
 
 Velodyne::Velodyne Velodyne::Velodyne::threshold(float thresh)
 {
-	PointCloud<Point> new_cloud;
-	for (PointCloud<Point>::iterator pt = point_cloud.points.begin(); pt < point_cloud.points.end(); pt++)
+	Velodyne thresholded;
+	threshold(thresh, thresholded);
+	return thresholded;
+}
+
+void Velodyne::Velodyne::threshold(float thresh, Velodyne &out) const
+{
+	// in place the kept points only move to the front
+	const size_t n = point_cloud.size();
+	if (&out != this)
 	{
-		if (pt->intensity > thresh)
+		out.point_cloud.points.resize(n);
+	}
+	size_t kept = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (point_cloud.points[i].intensity > thresh)
 		{
-			new_cloud.push_back(*pt);
+			out.point_cloud.points[kept++] = point_cloud.points[i];
 		}
 	}
-	return Velodyne(new_cloud);
+	out.point_cloud.points.resize(kept);
+	out.point_cloud.width = kept;
+	out.point_cloud.height = 1;
+	out.indexRings();
 }
 
 void Velodyne::Velodyne::detectPlanes(cv::Mat projection)
@@ -277,19 +356,34 @@ vector<Velodyne::Velodyne> Velodyne::Velodyne::depthSegmentation(int segment_cou
 PointCloud<PointXYZRGB> Velodyne::Velodyne::colour(cv::Mat frame_rgb, cv::Mat P)
 {
 	PointCloud<PointXYZRGB> color_cloud;
-	for (PointCloud<Point>::iterator pt = this->point_cloud.begin(); pt < this->point_cloud.end(); pt++)
+	colour(frame_rgb, P, color_cloud);
+	return color_cloud;
+}
+
+void Velodyne::Velodyne::colour(cv::Mat frame_rgb, cv::Mat P, PointCloud<PointXYZRGB> &color_cloud) const
+{
+	infant_utils::BatchProjection projection;
+	this->project(P, Rect(0, 0, frame_rgb.cols, frame_rgb.rows), projection);
+
+	color_cloud.clear();
+	color_cloud.reserve(point_cloud.size());
+	for (size_t i = 0; i < projection.size(); i++)
 	{
-		Point2f xy = Velodyne::Velodyne::projectf(*pt, P);
+		const Point &pt = point_cloud.points[i];
 
-		Vec3b rgb = Image::Image::atf(frame_rgb, xy);
+		// black outside the image
+		Vec3b rgb(0, 0, 0);
+		if (projection.visible(i))
+		{
+			rgb = Image::Image::atf(frame_rgb, Point2f(projection.u(i), projection.v(i)));
+		}
 		PointXYZRGB pt_rgb(rgb.val[2], rgb.val[1], rgb.val[0]);
-		pt_rgb.x = pt->x;
-		pt_rgb.y = pt->y;
-		pt_rgb.z = pt->z;
+		pt_rgb.x = pt.x;
+		pt_rgb.y = pt.y;
+		pt_rgb.z = pt.z;
 
 		color_cloud.push_back(pt_rgb);
 	}
-	return color_cloud;
 }
 
 }
@@ -50,6 +50,16 @@ Mat frame_rgb;
 Velodyne::Velodyne pointcloud;
 bool doRefinement = false;
 
+// refinement: "grid" or "coarse_to_fine"
+string REFINEMENT_METHOD;
+RefinementOptions refinement_options;
+
+// refinement over this many frames, collected before it starts
+int REFINEMENT_FRAMES;
+CalibrationRefinement batch_refinement;
+Calibration6DoF batch_translation;
+bool collecting = false;
+
 bool writeAllInputs(){
 	bool result = true;
 
@@ -63,6 +73,7 @@ bool writeAllInputs(){
 }
 
 Calibration6DoF calibration(bool doRefinement = false){
+	collecting = false;
 	Mat frame_gray;
 	cvtColor(frame_rgb, frame_gray, CV_BGR2GRAY);
 
@@ -94,10 +105,39 @@ Calibration6DoF calibration(bool doRefinement = false){
 		size_t divisions = 5;
 		float distance_transl = 0.02;
 		float distance_rot = 0.01;
+		if (REFINEMENT_FRAMES > 1){
+			// the coarse translations are averaged and the similarity summed over the frames
+			Calibration::addRefinementFrame(batch_refinement, Image::Image(frame_gray), pointcloud, projection_matrix);
+			batch_translation += translation;
+			ROS_INFO("Refinement frame %d of %d collected.", (int)batch_refinement.getFrames(), REFINEMENT_FRAMES);
+			collecting = (int)batch_refinement.getFrames() < REFINEMENT_FRAMES;
+			if (collecting){
+				return Calibration6DoF::wrong();
+			}
+			batch_translation /= REFINEMENT_FRAMES;
+			vector<float> &rough = batch_translation.DoF;
+			if (REFINEMENT_METHOD == "coarse_to_fine"){
+				Calibration6DoF best_calibration;
+				batch_refinement.search(rough[0], rough[1], rough[2], distance_transl, distance_rot, refinement_options,
+										best_calibration);
+				ROS_INFO_STREAM("Coarse-to-fine refinement: " << batch_refinement.getEvaluations() << " evaluations, score " << best_calibration.value);
+				return best_calibration;
+			}
+			Calibration6DoF best_calibration, avg_calibration;
+			batch_refinement.grid(rough[0], rough[1], rough[2], distance_transl, distance_rot, divisions, best_calibration,
+								  avg_calibration);
+			ROS_INFO_STREAM("Grid refinement: " << batch_refinement.getEvaluations() << " evaluations, score " << best_calibration.value);
+			return avg_calibration;
+		}
+		if (REFINEMENT_METHOD == "coarse_to_fine"){
+			return Calibration::calibrationRefinementCoarseToFine(Image::Image(frame_gray), pointcloud, projection_matrix,
+																	translation.DoF[0], translation.DoF[1], translation.DoF[2],
+																	distance_transl, distance_rot, refinement_options);
+		}
 		Calibration6DoF best_calibration, avg_calibration;
 		Calibration::calibrationRefinement(Image::Image(frame_gray), pointcloud, projection_matrix, translation.DoF[0],
 										   translation.DoF[1], translation.DoF[2], distance_transl, distance_rot, divisions,
-										   best_calibration, avg_calibration);
+										   best_calibration, avg_calibration, refinement_options.criteria);
 		return avg_calibration;
 	}
 	else{
@@ -129,7 +169,8 @@ void callback(const sensor_msgs::ImageConstPtr& msg_img, const sensor_msgs::Came
 	fromROSMsg(*msg_pc, pc);
 
 	// x := x, y := -z, z := y,
-	pointcloud = Velodyne::Velodyne(pc).transform(0, 0, 0, M_PI / 2, 0, 0);
+	pointcloud = Velodyne::Velodyne(pc);
+	pointcloud.transform(0, 0, 0, M_PI / 2, 0, 0, pointcloud);
 
 	// calibration:
 	writeAllInputs();
@@ -139,6 +180,9 @@ void callback(const sensor_msgs::ImageConstPtr& msg_img, const sensor_msgs::Came
 		calibrationParams.print();
 		shutdown();
 	}
+	else if (collecting){
+		ROS_INFO("Waiting for the next frame ...");
+	}
 	else{
 		ROS_WARN("Calibration failed - trying again after 5s ...");
 		ros::Duration(5).sleep();
@@ -172,6 +216,27 @@ int main(int argc, char** argv){
 	n.getParam("/but_calibration_camera_velodyne/marker/circles_distance", STRAIGHT_DISTANCE);
 	n.getParam("/but_calibration_camera_velodyne/marker/circles_radius", RADIUS);
 
+	int coarse_steps, seeds, pyramid_levels, max_iterations;
+	double tolerance_translation, tolerance_rotation;
+	string criteria;
+	n.param<string>("/but_calibration_camera_velodyne/refinement/method", REFINEMENT_METHOD, "grid");
+	n.param<string>("/but_calibration_camera_velodyne/refinement/criteria", criteria, "CC");
+	n.param("/but_calibration_camera_velodyne/refinement/coarse_steps", coarse_steps, 3);
+	n.param("/but_calibration_camera_velodyne/refinement/seeds", seeds, 4);
+	n.param("/but_calibration_camera_velodyne/refinement/pyramid_levels", pyramid_levels, 3);
+	n.param("/but_calibration_camera_velodyne/refinement/max_iterations", max_iterations, 200);
+	n.param("/but_calibration_camera_velodyne/refinement/frames", REFINEMENT_FRAMES, 1);
+	n.param("/but_calibration_camera_velodyne/refinement/tolerance_translation", tolerance_translation, 0.001);
+	n.param("/but_calibration_camera_velodyne/refinement/tolerance_rotation", tolerance_rotation, 0.0005);
+	refinement_options.coarse_steps = max(coarse_steps, 2);
+	refinement_options.seeds = max(seeds, 1);
+	refinement_options.pyramid_levels = max(pyramid_levels, 1);
+	refinement_options.max_iterations = max(max_iterations, 1);
+	refinement_options.tolerance_translation = tolerance_translation;
+	refinement_options.tolerance_rotation = tolerance_rotation;
+	refinement_options.criteria = Similarity::getCriteria(criteria);
+	batch_refinement = CalibrationRefinement(refinement_options.pyramid_levels, refinement_options.criteria);
+
 	message_filters::Subscriber<sensor_msgs::Image> image_sub(n, CAMERA_FRAME_TOPIC, 1);
 	message_filters::Subscriber<sensor_msgs::CameraInfo> info_sub(n, CAMERA_INFO_TOPIC, 1);
 	message_filters::Subscriber<sensor_msgs::PointCloud2> cloud_sub(n, VELODYNE_TOPIC, 1);
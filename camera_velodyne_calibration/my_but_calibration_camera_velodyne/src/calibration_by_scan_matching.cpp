@@ -5,20 +5,54 @@
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
+#include <pcl/common/eigen.h>
 
 #include <pcl/filters/approximate_voxel_grid.h>
 #include <pcl/registration/ndt.h>
 
+#include <boost/shared_ptr.hpp>
+
 #include <stdio.h>
+#include <algorithm>
+#include <random>
 
 using namespace std;
 
+typedef pcl::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ> NDT;
+
 string OUTPUT_FILE;
 string VELODYNE_FILE;
 string ZED_FILE;
 string OUTPUT_PCD;
 vector<float> init_DoF;
 
+// NDT grid resolutions, coarse to fine
+vector<double> resolutions;
+// initial guesses: init_6DoF and starts - 1 perturbed ones
+int starts;
+double perturbation_translation;
+double perturbation_rotation;
+int seed;
+int max_iterations;
+// More-Thuente step at resolution 1.0, scaled with the resolution
+double step_size;
+double transformation_epsilon;
+double leaf_size;
+
+// kept in a plain vector, so the pose must not need alignment
+struct Start
+{
+	Eigen::Matrix<float, 4, 4, Eigen::DontAlign> transformation;
+	double probability;
+	bool converged;
+	pcl::PointCloud<pcl::PointXYZ>::Ptr output;
+	boost::shared_ptr<NDT> ndt;
+};
+
+bool betterStart(const Start *s1, const Start *s2){
+	return s1->probability > s2->probability;
+}
+
 int main(int argc, char** argv)
 {
 	ros::init(argc, argv, "calibration_by_scan_matching");
@@ -42,6 +76,23 @@ int main(int argc, char** argv)
 	for(size_t i=0; i<init_DoF.size();i++){
 		cout<<"init_6DoF : "<<init_DoF[i]<<endl;
 	}
+	if(init_DoF.size() != 6){
+		ROS_ERROR("/init_6DoF has to have 6 values.");
+		return -1;
+	}
+
+	if(!n.getParam("/ndt/resolutions", resolutions) || resolutions.empty()){
+		resolutions = {4.0, 2.0, 1.0};
+	}
+	n.param("/ndt/starts", starts, 8);
+	n.param("/ndt/perturbation_translation", perturbation_translation, 0.3);
+	n.param("/ndt/perturbation_rotation", perturbation_rotation, 0.1);
+	n.param("/ndt/seed", seed, 0);
+	n.param("/ndt/max_iterations", max_iterations, 35);
+	n.param("/ndt/step_size", step_size, 0.1);
+	n.param("/ndt/transformation_epsilon", transformation_epsilon, 0.01);
+	n.param("/ndt/leaf_size", leaf_size, 0.2);
+	starts = max(starts, 1);
 
 	// Loading first pcd file.
 	pcl::PointCloud<pcl::PointXYZ>::Ptr target_cloud (new pcl::PointCloud<pcl::PointXYZ>);
@@ -63,47 +114,78 @@ int main(int argc, char** argv)
 	Eigen::Translation3f trans(init_DoF[0], init_DoF[1], init_DoF[2]);
 	Eigen::Matrix4f sample_matrix = (trans * rot).matrix();
 	pcl::transformPointCloud(*input_cloud, *input_cloud, sample_matrix);
-	pcl::io::savePCDFileASCII ("/home/amsl/ros_catkin_ws/src/master_thesis/camera_velodyne_calibration/my_but_calibration_camera_velodyne/pcd_data/sample_input.pcd", *input_cloud);
+	pcl::io::savePCDFileBinary ("/home/amsl/ros_catkin_ws/src/master_thesis/camera_velodyne_calibration/my_but_calibration_camera_velodyne/pcd_data/sample_input.pcd", *input_cloud);
 
 	pcl::PointCloud<pcl::PointXYZ>::Ptr filtered_cloud (new pcl::PointCloud<pcl::PointXYZ>);
 	pcl::ApproximateVoxelGrid<pcl::PointXYZ> approximate_voxel_filter;
-	approximate_voxel_filter.setLeafSize(0.2, 0.2, 0.2);
+	approximate_voxel_filter.setLeafSize(leaf_size, leaf_size, leaf_size);
 	approximate_voxel_filter.setInputCloud(input_cloud);
 	approximate_voxel_filter.filter(*filtered_cloud);
 
 	cout<<"Filtered cloud contains "<<filtered_cloud->size()<<" data points from source pcd file."<<endl;
 
+	// Initial guesses, the first one unperturbed.
+	vector<Start> guesses(starts);
+	mt19937 random(seed);
+	uniform_real_distribution<float> unit(-1.0, 1.0);
+	for(int s=0; s<starts; s++){
+		float DoF[6];
+		for(int i=0; i<6; i++){
+			float perturbation = i < 3 ? perturbation_translation : perturbation_rotation;
+			DoF[i] = init_DoF[i] + (s > 0 ? unit(random) * perturbation : 0);
+		}
+		guesses[s].transformation = pcl::getTransformation(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5]).matrix();
+		guesses[s].probability = 0;
+		guesses[s].converged = false;
+		guesses[s].output.reset(new pcl::PointCloud<pcl::PointXYZ>);
+	}
 
-	pcl::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ> ndt;
-
-	// Setting scale dependent NDT parameters
-	// Setting minimum transformation difference for termination condition.
-	ndt.setTransformationEpsilon(0.01);
-	// Setting maximum step size for More-Thuente line search.
-	ndt.setStepSize(0.1);
-	//Setting Resolution of NDT grid structure (VoxelGridCovariance).
-	ndt.setResolution(1.0);
-
-	// Setting max number of registration iterations.
-	ndt.setMaximumIterations(35);
-
-	// Setting point cloud to be aligned.
-	ndt.setInputSource(filtered_cloud);
-	// Setting point cloud to be aligned to.
-	ndt.setInputTarget(target_cloud);
-
-	Eigen::AngleAxisf init_rotation(0.0, Eigen::Vector3f::UnitZ());
-	Eigen::Translation3f init_translation(init_DoF[0], init_DoF[1], init_DoF[2]);
-	Eigen::Matrix4f init_guess = (init_translation * init_rotation).matrix();
-
-
-	pcl::PointCloud<pcl::PointXYZ>::Ptr output_cloud (new pcl::PointCloud<pcl::PointXYZ>);
-	ndt.align(*output_cloud, init_guess);
+	// Every resolution refines the surviving guesses in parallel, the better half goes on to the next one.
+	vector<Start*> alive;
+	for(int s=0; s<starts; s++){
+		alive.push_back(&guesses[s]);
+	}
+	for(size_t level=0; level<resolutions.size(); level++){
+		double resolution = resolutions[level];
+		ros::WallTime start = ros::WallTime::now();
+#pragma omp parallel for schedule(dynamic)
+		for(int k=0; k<(int)alive.size(); k++){
+			Start &guess = *alive[k];
+			guess.ndt.reset(new NDT);
+			// Setting minimum transformation difference for termination condition.
+			guess.ndt->setTransformationEpsilon(transformation_epsilon);
+			// Setting maximum step size for More-Thuente line search.
+			guess.ndt->setStepSize(step_size * resolution);
+			//Setting Resolution of NDT grid structure (VoxelGridCovariance).
+			guess.ndt->setResolution(resolution);
+			// Setting max number of registration iterations.
+			guess.ndt->setMaximumIterations(max_iterations);
+			guess.ndt->setInputSource(filtered_cloud);
+			guess.ndt->setInputTarget(target_cloud);
+
+			Eigen::Matrix4f initial = guess.transformation;
+			guess.ndt->align(*guess.output, initial);
+			guess.transformation = guess.ndt->getFinalTransformation();
+			guess.probability = guess.ndt->getTransformationProbability();
+			guess.converged = guess.ndt->hasConverged();
+		}
+		stable_sort(alive.begin(), alive.end(), betterStart);
+
+		cout<<"Resolution "<<resolution<<": "<<alive.size()<<" guesses, best probability "<<alive[0]->probability
+			<<", "<<(ros::WallTime::now() - start).toSec()<<" s"<<endl;
+		if(level + 1 < resolutions.size()){
+			for(size_t k=(alive.size() + 1) / 2; k<alive.size(); k++){
+				alive[k]->ndt.reset();
+			}
+			alive.resize((alive.size() + 1) / 2);
+		}
+	}
+	Start &best = *alive[0];
 
-	cout<<"Normal Distributions Transform has converged:"<<ndt.hasConverged()<<", score: "<<ndt.getFitnessScore()<<endl;
+	cout<<"Normal Distributions Transform has converged:"<<best.converged<<", score: "<<best.ndt->getFitnessScore()<<endl;
 
 	Eigen::Matrix4f t(Eigen::Matrix4f::Identity());
-	t = ndt.getFinalTransformation();
+	t = best.transformation;
 	cout<<t<<endl;
 
 	tf::Matrix3x3 mat;
@@ -122,7 +204,7 @@ int main(int argc, char** argv)
 	printf("6DoF: [%f, %f, %f, %f, %f, %f]\n", t(0, 3), t(1, 3), t(2, 3), roll, pitch, yaw);
 	
 	// Saving transformed input cloud.
-	pcl::io::savePCDFileASCII (OUTPUT_PCD, *output_cloud);
+	pcl::io::savePCDFileBinary (OUTPUT_PCD, *best.output);
 
 
 
@@ -7,6 +7,8 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <cmath>
 #include <boost/foreach.hpp>
 
 #include "opencv2/opencv.hpp"
@@ -17,6 +19,7 @@
 #include <std_msgs/Int32MultiArray.h>
 #include <sensor_msgs/image_encodings.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
 #include <sensor_msgs/CameraInfo.h>
 // #include <camera_info_manager/camera_info_manager.h>
 // #include <tf/tf.h>
@@ -30,6 +33,8 @@
 #include <pcl/common/eigen.h>
 #include <pcl/common/transforms.h>
 
+#include <infant_utils/stamped_buffer.h>
+
 #include <my_but_calibration_camera_velodyne/Image.h>
 #include <my_but_calibration_camera_velodyne/Velodyne.h>
 
@@ -49,10 +54,23 @@ ros::Publisher pub_debug2;
 ros::Publisher pub_debug3;
 ros::Publisher pub_full;
 cv::Mat projection_matrix;
+// buffers kept between the scans
+infant_utils::BatchProjection projection;
 
-cv::Mat frame_rgb;
+// recent camera frames, the one nearest to a scan colours it
+infant_utils::StampedBuffer<cv_bridge::CvImageConstPtr> frames;
 vector<float> DoF;
 
+// nearest depth per occlusion_cell x occlusion_cell pixels, 0 : no occlusion test
+int occlusion_cell;
+// a point this much farther than the nearest one of its cell is hidden
+double occlusion_ratio;
+vector<float> depth_buffer;
+
+// kept between the scans, only resized
+sensor_msgs::PointCloud2 color_msg;
+sensor_msgs::PointCloud2 full_msg;
+
 void cameraInfoCallback(const sensor_msgs::CameraInfoConstPtr& msg){
 	float p[12];
 	float *pp = p;
@@ -64,107 +82,170 @@ void cameraInfoCallback(const sensor_msgs::CameraInfoConstPtr& msg){
 }
 
 void imageCallback(const sensor_msgs::ImageConstPtr& msg){
-	cv_bridge::CvImagePtr cv_ptr = cv_bridge::toCvCopy(msg, sensor_msgs::image_encodings::BGR8);
-	frame_rgb = cv_ptr->image;
+	// shares the message data when it is bgr8 already
+	frames.push(msg->header.stamp, cv_bridge::toCvShare(msg, sensor_msgs::image_encodings::BGR8));
 }
 
-void pointCloudCallback(const sensor_msgs::PointCloud2ConstPtr& msg){
-	// if no rgb frame for coloring:
-	if (frame_rgb.data == NULL){
-		cout<<"No rgb data!!!!"<<endl;
-		return;
+int fieldOffset(const sensor_msgs::PointCloud2 &cloud, const string &name){
+	BOOST_FOREACH(const sensor_msgs::PointField &field, cloud.fields){
+		if (field.name == name && field.datatype == sensor_msgs::PointField::FLOAT32){
+			return field.offset;
+		}
+	}
+	return -1;
+}
+
+// the layout of PointCloud<PointXYZRGB>: x y z at 0, rgb at 16, 32 bytes a point
+void setXYZRGBLayout(sensor_msgs::PointCloud2 &cloud, const std_msgs::Header &header, uint32_t width, uint32_t height){
+	if (cloud.fields.size() != 4){
+		const char *names[4] = {"x", "y", "z", "rgb"};
+		const uint32_t offsets[4] = {0, 4, 8, 16};
+		cloud.fields.resize(4);
+		for (int f = 0; f < 4; f++){
+			cloud.fields[f].name = names[f];
+			cloud.fields[f].offset = offsets[f];
+			cloud.fields[f].datatype = sensor_msgs::PointField::FLOAT32;
+			cloud.fields[f].count = 1;
+		}
 	}
+	cloud.header = header;
+	cloud.width = width;
+	cloud.height = height;
+	cloud.is_bigendian = false;
+	cloud.point_step = 32;
+	cloud.row_step = cloud.point_step * width;
+	cloud.data.resize(cloud.row_step * height);
+}
 
+inline void writeXYZRGB(uint8_t *dst, const float *xyz, uint32_t rgb){
+	memcpy(dst, xyz, 3 * sizeof(float));
+	memcpy(dst + 16, &rgb, sizeof(rgb));
+}
+
+// mean of the 2 x 2 pixels from (x, y), as Image::atf, packed as the rgb of PCL
+inline uint32_t colourAt(const Mat &bgr, int x, int y){
+	int x1 = min(x + 1, bgr.cols - 1), y1 = min(y + 1, bgr.rows - 1);
+	const uint8_t *row0 = bgr.ptr<uint8_t>(y), *row1 = bgr.ptr<uint8_t>(y1);
+	uint32_t rgb = 0;
+	for (int i = 0; i < 3; i++){
+		int sum = row0[3 * x + i] + row0[3 * x1 + i] + row1[3 * x + i] + row1[3 * x1 + i];
+		rgb |= (uint32_t)(sum / 4) << (8 * i);
+	}
+	return rgb;
+}
+
+// the debug clouds of the axes switched and of the visible points, through the Velodyne class
+void publishDebug(const sensor_msgs::PointCloud2ConstPtr& msg, const Mat &frame){
 	PointCloud<Velodyne::Point> pc;
 	fromROSMsg(*msg, pc);
 
 	// x := x, y := -z, z := y,
-	Velodyne::Velodyne pointcloud = Velodyne::Velodyne(pc).transform(0, 0, 0, M_PI/2, -M_PI/2, 0);
+	Velodyne::Velodyne pointcloud(pc);
+	pointcloud.transform(0, 0, 0, M_PI/2, -M_PI/2, 0, pointcloud);
 
-	PointCloud<PointXYZ>* pcl_pc;
-	pcl_pc = pointcloud.toPointsXYZ();
+	boost::shared_ptr<PointCloud<PointXYZ> > pcl_pc(pointcloud.toPointsXYZ());
 	sensor_msgs::PointCloud2 pc2;
 	toROSMsg(*pcl_pc, pc2);
 	pc2.header = msg->header;
 	pub_debug.publish(pc2);
 
-	Image::Image img(frame_rgb);
-	Velodyne::Velodyne transformed = pointcloud.transform(DoF);
 	PointCloud<Velodyne::Point> visible_points;
-	// transformed.project(projection_matrix, Rect(0, 0, frame_rgb.cols, frame_rgb.rows), &visible_points);
-	vector<int> index;
-	transformed.project(projection_matrix, Rect(0, 0, frame_rgb.cols, frame_rgb.rows), &visible_points, &index);
-	// for(size_t i=0;i<index.size();i++){
-		// cout<<"index["<<i<<"] : "<<index[i]<<endl;
-	// }
-
+	pointcloud.transform(DoF, pointcloud);
+	pointcloud.project(projection_matrix, Rect(0, 0, frame.cols, frame.rows), &visible_points);
 	sensor_msgs::PointCloud2 pc2_debug2;
 	toROSMsg(visible_points, pc2_debug2);
 	pc2_debug2.header = msg->header;
 	pub_debug2.publish(pc2_debug2);
-	// cout<<"visible_points : "<<visible_points.points.size()<<endl;
-
-	cout<<"frame_rgb.cols : "<<frame_rgb.cols<<" typeid(frame_rgb.cols).name() : "<<typeid(frame_rgb.cols).name()<<endl;
-	cout<<"frame_rgb.rows : "<<frame_rgb.rows<<" typeid(frame_rgb.rows).name() : "<<typeid(frame_rgb.rows).name()<<endl;
+}
 
-	Velodyne::Velodyne visible_scan(visible_points);
+/*
+ * One pass over the PointCloud2 data: every point is projected with
+ * P x 6DoF x axes switching at once; the points visible and not hidden
+ * behind a nearer one (depth buffer) are coloured. VELODYNE_COLOR_TOPIC
+ * gets the coloured points with the axes switched back, the full topic
+ * the whole scan in its own frame, black where not coloured.
+ */
+void pointCloudCallback(const sensor_msgs::PointCloud2ConstPtr& msg){
+	int nearest = frames.nearest(msg->header.stamp);
+	// if no rgb frame for coloring:
+	if (nearest < 0){
+		cout<<"No rgb data!!!!"<<endl;
+		return;
+	}
+	if (projection_matrix.empty()){
+		cout<<"No camera info!!!!"<<endl;
+		return;
+	}
+	const Mat &frame = frames.value(nearest)->image;
 
-	PointCloud<PointXYZRGB> color_cloud = visible_scan.colour(frame_rgb, projection_matrix);
+	if (pub_debug.getNumSubscribers() > 0 || pub_debug2.getNumSubscribers() > 0){
+		publishDebug(msg, frame);
+	}
 
-	// sensor_msgs::PointCloud2 pc2_color;
-	// toROSMsg(color_cloud, pc2_color);
-	// pc2_color.header = msg->header;
-	// pub_debug3.publish(pc2_color);
+	int x_offset = fieldOffset(*msg, "x");
+	if (x_offset < 0 || fieldOffset(*msg, "y") != x_offset + 4 || fieldOffset(*msg, "z") != x_offset + 8){
+		ROS_ERROR("Coloring needs packed float x, y, z fields.");
+		return;
+	}
+	size_t n = (size_t)msg->width * msg->height;
+	const uint8_t *data = msg->data.data();
 
+	// x := x, y := -z, z := y, then the 6DoF
+	Eigen::Affine3f to_camera = getTransformation(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5]) *
+								getTransformation(0, 0, 0, M_PI/2, -M_PI/2, 0);
 	// reverse axix switching:
-	Eigen::Affine3f transf = getTransformation(0, 0, 0, -M_PI/2, 0, -M_PI/2);
-	transformPointCloud(color_cloud, color_cloud, transf);
-	
-
-	PointCloud<PointXYZRGB> full_cloud;
-	fromROSMsg(*msg, full_cloud);
-
-	size_t full_cloud_size = full_cloud.points.size();
-	for(size_t i=0;i<full_cloud_size;i++){
-		full_cloud.points[i].r = 0;
-		full_cloud.points[i].g = 0;
-		full_cloud.points[i].b = 0;
+	Eigen::Affine3f to_output = getTransformation(0, 0, 0, -M_PI/2, 0, -M_PI/2) * to_camera;
+	Eigen::Matrix<float, 3, 4> P;
+	for (int r = 0; r < 3; r++){
+		for (int col = 0; col < 4; col++){
+			P(r, col) = projection_matrix.at<float>(r, col);
+		}
 	}
-	
-	size_t color_cloud_size = color_cloud.points.size();
-	for(size_t i=0;i<color_cloud_size;i++){
-		// cout<<"index["<<i<<"] : "<<index[i]<<endl;
-		// cout<<"color_cloud.points["<<i<<"].x : "<<color_cloud.points[i].x<<endl;
-		// cout<<"color_cloud.points["<<i<<"].y : "<<color_cloud.points[i].y<<endl;
-		// cout<<"color_cloud.points["<<i<<"].z : "<<color_cloud.points[i].z<<endl;
-		// cout<<"color_cloud.points["<<i<<"].r : "<<unsigned(color_cloud.points[i].r)<<endl;
-		// cout<<"color_cloud.points["<<i<<"].g : "<<unsigned(color_cloud.points[i].g)<<endl;
-		// cout<<"color_cloud.points["<<i<<"].b : "<<unsigned(color_cloud.points[i].b)<<endl;
-
-		// cout<<"full_cloud.points["<<index[i]<<"].x : "<<full_cloud.points[index[i]].x<<endl;
-		// cout<<"full_cloud.points["<<index[i]<<"].y : "<<full_cloud.points[index[i]].y<<endl;
-		// cout<<"full_cloud.points["<<index[i]<<"].z : "<<full_cloud.points[index[i]].z<<endl;
-
-		full_cloud.points[index[i]].r = color_cloud.points[i].r;
-		full_cloud.points[index[i]].g = color_cloud.points[i].g;
-		full_cloud.points[index[i]].b = color_cloud.points[i].b;
-
-		// cout<<"full_cloud.points["<<index[i]<<"].r : "<<unsigned(full_cloud.points[index[i]].r)<<endl;
-		// cout<<"full_cloud.points["<<index[i]<<"].g : "<<unsigned(full_cloud.points[index[i]].g)<<endl;
-		// cout<<"full_cloud.points["<<index[i]<<"].b : "<<unsigned(full_cloud.points[index[i]].b)<<endl;
+	projection.setMatrix(Eigen::Matrix<float, 3, 4>(P * to_camera.matrix()));
+	projection.setFrame(frame.cols, frame.rows);
+	projection.project(data + x_offset, n, msg->point_step);
+
+	int cell = occlusion_cell;
+	int cells_x = cell > 0 ? (frame.cols + cell - 1) / cell : 0;
+	if (cell > 0){
+		depth_buffer.assign(cells_x * ((frame.rows + cell - 1) / cell), INFINITY);
+		for (size_t i = 0; i < n; i++){
+			if (projection.visible(i)){
+				float &nearest_depth = depth_buffer[projection.row(i) / cell * cells_x + projection.col(i) / cell];
+				nearest_depth = min(nearest_depth, projection.depth(i));
+			}
+		}
 	}
 
-	sensor_msgs::PointCloud2 color_cloud2;
-	toROSMsg(color_cloud, color_cloud2);
-	color_cloud2.header = msg->header;
-	pub.publish(color_cloud2);
-
-	sensor_msgs::PointCloud2 full_cloud2;
-	toROSMsg(full_cloud, full_cloud2);
-	full_cloud2.header = msg->header;
-	pub_full.publish(full_cloud2);
-
+	setXYZRGBLayout(full_msg, msg->header, msg->width, msg->height);
+	full_msg.is_dense = msg->is_dense;
+	setXYZRGBLayout(color_msg, msg->header, projection.visibleCount(), 1);
+	color_msg.is_dense = true;
+	uint8_t *full = full_msg.data.data();
+	uint8_t *color = color_msg.data.data();
+	size_t colored = 0;
+	for (size_t i = 0; i < n; i++, full += full_msg.point_step){
+		const uint8_t *point = data + msg->point_step * i + x_offset;
+		float xyz[3];
+		memcpy(xyz, point, sizeof(xyz));
+
+		bool hidden = !projection.visible(i) ||
+				(cell > 0 && projection.depth(i) > depth_buffer[projection.row(i) / cell * cells_x + projection.col(i) / cell] * (1 + occlusion_ratio));
+		uint32_t rgb = hidden ? 0 : colourAt(frame, projection.col(i), projection.row(i));
+		writeXYZRGB(full, xyz, rgb);
+		if (hidden){
+			continue;
+		}
+
+		Eigen::Vector3f output = to_output * Eigen::Vector3f(xyz[0], xyz[1], xyz[2]);
+		writeXYZRGB(color, output.data(), rgb);
+		color += color_msg.point_step;
+		colored++;
+	}
+	setXYZRGBLayout(color_msg, msg->header, colored, 1);
 
+	pub.publish(color_msg);
+	pub_full.publish(full_msg);
 }
 
 int main(int argc, char** argv)
@@ -177,6 +258,16 @@ int main(int argc, char** argv)
 	n.getParam("/but_calibration_camera_velodyne/velodyne_topic", VELODYNE_TOPIC);
 	n.getParam("/but_calibration_camera_velodyne/velodyne_color_topic", VELODYNE_COLOR_TOPIC);
 	n.getParam("/but_calibration_camera_velodyne/6DoF", DoF);
+	if (DoF.size() != 6){
+		ROS_ERROR("/but_calibration_camera_velodyne/6DoF has to have 6 values.");
+		return EXIT_FAILURE;
+	}
+
+	int image_buffer;
+	n.param("/but_calibration_camera_velodyne/coloring/image_buffer", image_buffer, 5);
+	n.param("/but_calibration_camera_velodyne/coloring/occlusion_cell", occlusion_cell, 8);
+	n.param("/but_calibration_camera_velodyne/coloring/occlusion_ratio", occlusion_ratio, 0.1);
+	frames.setCapacity(image_buffer);
 
 	pub = n.advertise<sensor_msgs::PointCloud2>(VELODYNE_COLOR_TOPIC, 1);
 	pub_debug = n.advertise<sensor_msgs::PointCloud2>("/velodyne_debug", 1);
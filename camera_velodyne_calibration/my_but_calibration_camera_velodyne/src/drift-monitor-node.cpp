@@ -0,0 +1,302 @@
+/*
+ * drift-monitor-node.cpp
+ *
+ * Watches the camera - Velodyne calibration (6DoF, as used by the coloring)
+ * on a decimated stream of synchronized frames.
+ *
+ * On every monitored frame the edge similarity of the current 6DoF is
+ * compared with its 12 neighbours (+-perturbation along every axis); the
+ * share of neighbours scoring lower is the confidence of the frame, which
+ * is smoothed over the frames. When the confidence falls below
+ * min_confidence, a small coarse-to-fine search around the current 6DoF
+ * runs over the last window frames and its result is published as a
+ * suggestion. The 6DoF in use is not changed.
+ *
+ * The edges are computed on the image scaled by edge_scale (with P scaled
+ * to match), as the IDT dominates the cost of a frame. The search runs in
+ * its own thread on a copy of the window, so the callbacks keep going; a
+ * window handed over while a search runs waits, a newer one replaces it.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <deque>
+
+#include "opencv2/opencv.hpp"
+
+#include <ros/ros.h>
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/image_encodings.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <std_msgs/Float32.h>
+#include <std_msgs/Float32MultiArray.h>
+
+#include <message_filters/subscriber.h>
+#include <message_filters/synchronizer.h>
+#include <message_filters/sync_policies/approximate_time.h>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <my_but_calibration_camera_velodyne/Velodyne.h>
+#include <my_but_calibration_camera_velodyne/Calibration.h>
+#include <my_but_calibration_camera_velodyne/Image.h>
+
+using namespace cv;
+using namespace std;
+using namespace ros;
+using namespace message_filters;
+using namespace pcl;
+using namespace but_calibration_camera_velodyne;
+
+string CAMERA_FRAME_TOPIC;
+string CAMERA_INFO_TOPIC;
+string VELODYNE_TOPIC;
+
+vector<float> DoF;
+
+// every decimation-th synchronized frame is monitored
+int decimation;
+// thresholded scan points kept per frame
+int max_points;
+// the edge image is computed at this scale of the camera image
+double edge_scale;
+double perturbation_translation;
+double perturbation_rotation;
+// weight of a new frame in the confidence
+double smoothing;
+double min_confidence;
+// frames kept for the search
+int window;
+double search_translation;
+double search_rotation;
+RefinementOptions search_options;
+
+struct Sample
+{
+	Mat edges;
+	Velodyne::Velodyne scan;
+	Mat P;
+};
+deque<Sample> samples;
+
+// window waiting for the search thread, only the latest one is kept
+boost::mutex search_mutex;
+boost::condition_variable search_condition;
+deque<Sample> search_window;
+bool search_pending = false;
+bool search_stop = false;
+
+int frame_counter = 0;
+int frames_since_search = 0;
+float confidence = 1.0;
+
+ros::Publisher pub_confidence;
+ros::Publisher pub_suggestion;
+
+// edge scan for the similarity, every k-th point to keep at most max_points
+Velodyne::Velodyne prepareScan(Velodyne::Velodyne scan){
+	scan.intensityByRangeDiff();
+	scan.threshold(0.05, scan);
+	size_t step = max_points > 0 ? (scan.size() + max_points - 1) / max_points : 1;
+	if (step <= 1){
+		return scan;
+	}
+	Velodyne::Velodyne decimated;
+	PointCloud<Velodyne::Point>::iterator pt = scan.begin();
+	for (size_t i = 0; i < scan.size(); i++, pt++){
+		if (i % step == 0){
+			decimated.push_back(*pt);
+		}
+	}
+	return decimated;
+}
+
+// share of the neighbours of DoF scoring lower than DoF itself
+float frameConfidence(CalibrationRefinement &refinement){
+	float current = refinement.evaluate(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5]);
+	int lower = 0;
+	for (int axis = 0; axis < 6; axis++){
+		for (int sign = -1; sign <= 1; sign += 2){
+			vector<float> neighbour(DoF);
+			neighbour[axis] += sign * (axis < 3 ? perturbation_translation : perturbation_rotation);
+			float value = refinement.evaluate(neighbour[0], neighbour[1], neighbour[2], neighbour[3], neighbour[4], neighbour[5]);
+			if (value < current){
+				lower++;
+			}
+		}
+	}
+	return lower / 12.0;
+}
+
+void search(deque<Sample> &window){
+	CalibrationRefinement refinement(search_options.pyramid_levels, search_options.criteria);
+	BOOST_FOREACH(Sample &sample, window){
+		refinement.addFrame(sample.edges, sample.scan, sample.P);
+	}
+
+	float current = refinement.evaluate(DoF[0], DoF[1], DoF[2], DoF[3], DoF[4], DoF[5]);
+	Calibration6DoF best;
+	refinement.search(&DoF[0], search_translation, search_rotation, search_options, best);
+	if (best.value <= current){
+		ROS_INFO("Drift monitor: no better calibration around the current one.");
+		return;
+	}
+	float gain = current > 0 ? best.value / current - 1 : 0;
+
+	std_msgs::Float32MultiArray suggestion;
+	suggestion.data = best.DoF;
+	suggestion.data.push_back(gain);
+	pub_suggestion.publish(suggestion);
+	ROS_WARN("Drift monitor: suggested 6DoF [%f %f %f %f %f %f], score +%.1f%% over %d frames (%ld evaluations).",
+			 best.DoF[0], best.DoF[1], best.DoF[2], best.DoF[3], best.DoF[4], best.DoF[5], gain * 100,
+			 (int)window.size(), refinement.getEvaluations());
+}
+
+void searchThread(){
+	for (;;){
+		deque<Sample> window;
+		{
+			boost::unique_lock<boost::mutex> lock(search_mutex);
+			while (!search_pending && !search_stop){
+				search_condition.wait(lock);
+			}
+			if (search_stop){
+				return;
+			}
+			window.swap(search_window);
+			search_pending = false;
+		}
+		search(window);
+	}
+}
+
+// hands the current window to the search thread
+void requestSearch(){
+	boost::lock_guard<boost::mutex> lock(search_mutex);
+	search_window = samples;
+	search_pending = true;
+	search_condition.notify_one();
+}
+
+void callback(const sensor_msgs::ImageConstPtr& msg_img, const sensor_msgs::CameraInfoConstPtr& msg_info, const sensor_msgs::PointCloud2ConstPtr& msg_pc){
+	if (frame_counter++ % decimation != 0){
+		return;
+	}
+	ros::WallTime start = ros::WallTime::now();
+
+	cv_bridge::CvImagePtr cv_ptr = cv_bridge::toCvCopy(msg_img, sensor_msgs::image_encodings::MONO8);
+
+	float p[12];
+	float *pp = p;
+	for (boost::array<double, 12ul>::const_iterator i = msg_info->P.begin(); i != msg_info->P.end(); i++){
+		*pp = (float)(*i);
+		pp++;
+	}
+	Sample sample;
+	cv::Mat(3, 4, CV_32FC1, &p).copyTo(sample.P);
+
+	PointCloud<Velodyne::Point> pc;
+	fromROSMsg(*msg_pc, pc);
+	// x := x, y := -z, z := y, as the coloring does
+	Velodyne::Velodyne scan(pc);
+	scan.transform(0, 0, 0, M_PI / 2, -M_PI / 2, 0, scan);
+	sample.scan = prepareScan(scan);
+
+	Mat image = cv_ptr->image;
+	if (edge_scale < 1.0){
+		resize(cv_ptr->image, image, Size(), edge_scale, edge_scale, INTER_AREA);
+		for (int c = 0; c < 4; c++){
+			sample.P.at<float>(0, c) *= edge_scale;
+			sample.P.at<float>(1, c) *= edge_scale;
+		}
+	}
+	sample.edges = Image::Image(image).computeIDTEdgeImage();
+
+	CalibrationRefinement refinement(1, search_options.criteria);
+	refinement.addFrame(sample.edges, sample.scan, sample.P);
+	float frame_confidence = frameConfidence(refinement);
+	confidence = (1 - smoothing) * confidence + smoothing * frame_confidence;
+
+	samples.push_back(sample);
+	while ((int)samples.size() > window){
+		samples.pop_front();
+	}
+	frames_since_search++;
+
+	std_msgs::Float32 msg_confidence;
+	msg_confidence.data = confidence;
+	pub_confidence.publish(msg_confidence);
+	ROS_DEBUG("Drift monitor: frame confidence %.2f, smoothed %.2f, %.1f ms", frame_confidence, confidence,
+			  (ros::WallTime::now() - start).toSec() * 1000);
+
+	// at most once per window
+	if (confidence < min_confidence && (int)samples.size() == window && frames_since_search >= window){
+		frames_since_search = 0;
+		requestSearch();
+	}
+}
+
+int main(int argc, char** argv){
+	ros::init(argc, argv, "drift_monitor_node");
+
+	ros::NodeHandle n;
+	n.getParam("/but_calibration_camera_velodyne/camera_frame_topic", CAMERA_FRAME_TOPIC);
+	n.getParam("/but_calibration_camera_velodyne/camera_info_topic", CAMERA_INFO_TOPIC);
+	n.getParam("/but_calibration_camera_velodyne/velodyne_topic", VELODYNE_TOPIC);
+	n.getParam("/but_calibration_camera_velodyne/6DoF", DoF);
+	if (DoF.size() != 6){
+		ROS_ERROR("/but_calibration_camera_velodyne/6DoF has to have 6 values.");
+		return EXIT_FAILURE;
+	}
+
+	string criteria;
+	n.param("/but_calibration_camera_velodyne/drift_monitor/decimation", decimation, 10);
+	n.param("/but_calibration_camera_velodyne/drift_monitor/max_points", max_points, 5000);
+	n.param("/but_calibration_camera_velodyne/drift_monitor/edge_scale", edge_scale, 0.5);
+	n.param("/but_calibration_camera_velodyne/drift_monitor/perturbation_translation", perturbation_translation, 0.01);
+	n.param("/but_calibration_camera_velodyne/drift_monitor/perturbation_rotation", perturbation_rotation, 0.005);
+	n.param("/but_calibration_camera_velodyne/drift_monitor/smoothing", smoothing, 0.2);
+	n.param("/but_calibration_camera_velodyne/drift_monitor/min_confidence", min_confidence, 0.6);
+	n.param("/but_calibration_camera_velodyne/drift_monitor/window", window, 5);
+	n.param("/but_calibration_camera_velodyne/drift_monitor/search_translation", search_translation, 0.02);
+	n.param("/but_calibration_camera_velodyne/drift_monitor/search_rotation", search_rotation, 0.01);
+	n.param<string>("/but_calibration_camera_velodyne/drift_monitor/criteria", criteria, "CC");
+	decimation = max(decimation, 1);
+	window = max(window, 1);
+	if (!(edge_scale > 0.0 && edge_scale <= 1.0)){
+		edge_scale = 1.0;
+	}
+	search_options.coarse_steps = 2;
+	search_options.seeds = 2;
+	search_options.pyramid_levels = 2;
+	search_options.max_iterations = 50;
+	search_options.criteria = Similarity::getCriteria(criteria);
+
+	pub_confidence = n.advertise<std_msgs::Float32>("/but_calibration_camera_velodyne/drift_monitor/confidence", 1);
+	pub_suggestion = n.advertise<std_msgs::Float32MultiArray>("/but_calibration_camera_velodyne/drift_monitor/suggested_6DoF", 1, true);
+
+	message_filters::Subscriber<sensor_msgs::Image> image_sub(n, CAMERA_FRAME_TOPIC, 1);
+	message_filters::Subscriber<sensor_msgs::CameraInfo> info_sub(n, CAMERA_INFO_TOPIC, 1);
+	message_filters::Subscriber<sensor_msgs::PointCloud2> cloud_sub(n, VELODYNE_TOPIC, 1);
+
+	typedef sync_policies::ApproximateTime<sensor_msgs::Image, sensor_msgs::CameraInfo, sensor_msgs::PointCloud2> MySyncPolicy;
+	Synchronizer<MySyncPolicy> sync(MySyncPolicy(10), image_sub, info_sub, cloud_sub);
+	sync.registerCallback(boost::bind(&callback, _1, _2, _3));
+
+	boost::thread search_thread(searchThread);
+
+	ros::spin();
+
+	{
+		boost::lock_guard<boost::mutex> lock(search_mutex);
+		search_stop = true;
+		search_condition.notify_one();
+	}
+	search_thread.join();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+/*
+ * candidate_point.h
+ *
+ * Point of /human_points/candidate: PointXYZRGBNormal plus the index of
+ * the detection box it was taken from. The fields of PointXYZRGBNormal
+ * keep their names, so nodes that read the candidates as
+ * PointXYZRGBNormal just ignore the label.
+ */
+
+#ifndef CANDIDATE_POINT_H_
+#define CANDIDATE_POINT_H_
+
+#include <stdint.h>
+
+#include <pcl/point_types.h>
+#include <pcl/register_point_struct.h>
+
+namespace clustering
+{
+
+struct EIGEN_ALIGN16 CandidatePoint
+{
+	PCL_ADD_POINT4D;
+	PCL_ADD_NORMAL4D;
+	union
+	{
+		struct
+		{
+			PCL_ADD_UNION_RGB;
+			float curvature;
+		};
+		float data_c[4];
+	};
+	// box index in the detection message
+	uint32_t label;
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+template<class PointT>
+inline void toCandidate(const PointT &p, uint32_t label, CandidatePoint &c)
+{
+	c.x = p.x; c.y = p.y; c.z = p.z;
+	c.data[3] = 1.0f;
+	c.normal_x = p.normal_x; c.normal_y = p.normal_y; c.normal_z = p.normal_z;
+	c.data_n[3] = 0.0f;
+	c.rgb = p.rgb;
+	c.curvature = p.curvature;
+	c.label = label;
+}
+
+} // namespace clustering
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(
+	clustering::CandidatePoint,
+	(float, x, x) (float, y, y) (float, z, z)
+	(float, rgb, rgb)
+	(float, normal_x, normal_x) (float, normal_y, normal_y) (float, normal_z, normal_z)
+	(float, curvature, curvature)
+	(uint32_t, label, label))
+
+#endif /* CANDIDATE_POINT_H_ */
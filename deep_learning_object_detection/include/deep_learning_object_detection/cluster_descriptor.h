@@ -0,0 +1,180 @@
+/*
+ * cluster_descriptor.h
+ *
+ * Per-cluster summary published next to the clusters, one
+ * ClusterDescriptor "point" per cluster on /human_points/descriptors, so
+ * the visualizer and the tracker never read the cluster points again.
+ *
+ * The first sweep over the indices of a cluster gathers the moments for
+ * the centroid and the xy covariance, the axis-aligned box and the height
+ * histogram. The yaw of the oriented box is the major eigenvector of the
+ * xy covariance; a second sweep projects the points on it and on its
+ * perpendicular for the extents.
+ *
+ * The human cluster is described by its points that pass the normal
+ * filter (the /human_points cloud), not by the whole nearest cluster.
+ */
+
+#ifndef CLUSTER_DESCRIPTOR_H_
+#define CLUSTER_DESCRIPTOR_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/register_point_struct.h>
+
+#include <deep_learning_object_detection/cluster_view.h>
+
+namespace clustering
+{
+
+static const int DESCRIPTOR_HIST_BINS = 8;
+
+enum
+{
+	DESCRIPTOR_HUMAN = 1 << 0  // human points of the cluster nearest to the LiDAR
+};
+
+struct ClusterDescriptor
+{
+	// centroid
+	float x, y, z;
+	// axis-aligned box
+	float min_x, min_y, min_z;
+	float max_x, max_y, max_z;
+	// oriented box: centre, yaw of the length axis (in [0, pi)), and extents
+	float obb_x, obb_y, obb_z;
+	float yaw;
+	float length, width, height;
+	uint32_t count;
+	// rank of the cluster by size, 0 is the largest
+	uint32_t label;
+	uint32_t flags;
+	// fraction of the points per height_bin above the ground plane, the
+	// last bin holds everything higher
+	float hist[DESCRIPTOR_HIST_BINS];
+};
+
+struct DescriptorParams
+{
+	// ground plane (a, b, c, d) with a unit, upward normal
+	Eigen::Vector4f ground;
+	float height_bin;
+
+	DescriptorParams() : ground(0.0, 0.0, 1.0, 0.0), height_bin(0.25f)
+	{
+	}
+};
+
+// descriptor of a subset of the points of cluster k
+template<class PointT>
+void describeIndices(const ClusterView<PointT> &clusters, const std::vector<int> &indices, size_t k,
+					 const DescriptorParams &params, ClusterDescriptor &d)
+{
+	d = ClusterDescriptor();
+	d.label = k;
+	d.count = indices.size();
+	if(indices.empty()) return;
+
+	int hist[DESCRIPTOR_HIST_BINS] = {0};
+	// moments relative to the first point against cancellation
+	const PointT &p0 = clusters.point(indices[0]);
+	double sx = 0.0, sy = 0.0, sz = 0.0, sxx = 0.0, sxy = 0.0, syy = 0.0;
+	d.min_x = d.max_x = p0.x;
+	d.min_y = d.max_y = p0.y;
+	d.min_z = d.max_z = p0.z;
+
+	for(size_t m = 0; m < indices.size(); m++){
+		const PointT &p = clusters.point(indices[m]);
+		double dx = p.x - p0.x, dy = p.y - p0.y, dz = p.z - p0.z;
+		sx += dx; sy += dy; sz += dz;
+		sxx += dx * dx; sxy += dx * dy; syy += dy * dy;
+
+		d.min_x = std::min(d.min_x, p.x); d.max_x = std::max(d.max_x, p.x);
+		d.min_y = std::min(d.min_y, p.y); d.max_y = std::max(d.max_y, p.y);
+		d.min_z = std::min(d.min_z, p.z); d.max_z = std::max(d.max_z, p.z);
+
+		float h = params.ground(0) * p.x + params.ground(1) * p.y + params.ground(2) * p.z + params.ground(3);
+		int bin = (int)floor(h / params.height_bin);
+		hist[std::max(0, std::min(DESCRIPTOR_HIST_BINS - 1, bin))]++;
+	}
+
+	double n = indices.size();
+	d.x = p0.x + sx / n;
+	d.y = p0.y + sy / n;
+	d.z = p0.z + sz / n;
+	for(int b = 0; b < DESCRIPTOR_HIST_BINS; b++) d.hist[b] = hist[b] / n;
+
+	// major eigenvector of the xy covariance, turned into [0, pi)
+	Eigen::Matrix2d cov;
+	cov(0, 0) = sxx / n - (sx / n) * (sx / n);
+	cov(0, 1) = cov(1, 0) = sxy / n - (sx / n) * (sy / n);
+	cov(1, 1) = syy / n - (sy / n) * (sy / n);
+	Eigen::SelfAdjointEigenSolver<Eigen::Matrix2d> es;
+	es.computeDirect(cov);
+	Eigen::Vector2d axis = es.eigenvectors().col(1);
+	if(axis(1) < 0.0 || (axis(1) == 0.0 && axis(0) < 0.0)) axis = -axis;
+	float c = axis(0), s = axis(1);
+
+	// extents along the axis (u) and across it (v), relative to p0
+	float u_min = 0.0f, u_max = 0.0f, v_min = 0.0f, v_max = 0.0f;
+	for(size_t m = 0; m < indices.size(); m++){
+		const PointT &p = clusters.point(indices[m]);
+		float dx = p.x - p0.x, dy = p.y - p0.y;
+		float u = dx * c + dy * s;
+		float v = dy * c - dx * s;
+		u_min = std::min(u_min, u); u_max = std::max(u_max, u);
+		v_min = std::min(v_min, v); v_max = std::max(v_max, v);
+	}
+
+	float u_mid = 0.5f * (u_min + u_max);
+	float v_mid = 0.5f * (v_min + v_max);
+	d.yaw = atan2(s, c);
+	d.length = u_max - u_min;
+	d.width = v_max - v_min;
+	d.height = d.max_z - d.min_z;
+	d.obb_x = p0.x + u_mid * c - v_mid * s;
+	d.obb_y = p0.y + u_mid * s + v_mid * c;
+	d.obb_z = 0.5 * (d.min_z + d.max_z);
+}
+
+template<class PointT>
+void describeCluster(const ClusterView<PointT> &clusters, size_t k,
+					 const DescriptorParams &params, ClusterDescriptor &d)
+{
+	describeIndices(clusters, clusters.indices(k), k, params, d);
+}
+
+template<class PointT>
+void describeClusters(const ClusterView<PointT> &clusters, const DescriptorParams &params,
+					  pcl::PointCloud<ClusterDescriptor> &descriptors)
+{
+	descriptors.points.resize(clusters.size());
+	for(size_t k = 0; k < clusters.size(); k++){
+		describeCluster(clusters, k, params, descriptors.points[k]);
+	}
+	descriptors.width = descriptors.points.size();
+	descriptors.height = 1;
+}
+
+} // namespace clustering
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(
+	clustering::ClusterDescriptor,
+	(float, x, x) (float, y, y) (float, z, z)
+	(float, min_x, min_x) (float, min_y, min_y) (float, min_z, min_z)
+	(float, max_x, max_x) (float, max_y, max_y) (float, max_z, max_z)
+	(float, obb_x, obb_x) (float, obb_y, obb_y) (float, obb_z, obb_z)
+	(float, yaw, yaw)
+	(float, length, length) (float, width, width) (float, height, height)
+	(uint32_t, count, count) (uint32_t, label, label) (uint32_t, flags, flags)
+	(float[8], hist, hist))
+
+#endif /* CLUSTER_DESCRIPTOR_H_ */
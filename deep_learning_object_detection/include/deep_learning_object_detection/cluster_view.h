@@ -0,0 +1,96 @@
+/*
+ * cluster_view.h
+ *
+ * Clusters as index lists into one shared cloud.
+ *
+ * The clustering result is kept as the input cloud (shared, never copied)
+ * plus one pcl::PointIndices per cluster. Centroids, distances and bounds
+ * are computed through the indices; a cluster is only copied into a cloud
+ * of its own by materialize(), for the topics somebody listens to.
+ */
+
+#ifndef CLUSTER_VIEW_H_
+#define CLUSTER_VIEW_H_
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <pcl/point_cloud.h>
+#include <pcl/PointIndices.h>
+#include <pcl/common/common.h>
+#include <pcl/common/centroid.h>
+
+namespace clustering
+{
+
+template<class PointT>
+class ClusterView
+{
+public:
+	typedef pcl::PointCloud<PointT> Cloud;
+	typedef typename Cloud::ConstPtr CloudConstPtr;
+
+	ClusterView() {}
+	explicit ClusterView(const CloudConstPtr &cloud) : cloud_(cloud) {}
+
+	void setCloud(const CloudConstPtr &cloud)
+	{
+		cloud_ = cloud;
+		clusters_.clear();
+	}
+
+	const Cloud &cloud() const { return *cloud_; }
+	const CloudConstPtr &cloudPtr() const { return cloud_; }
+
+	// filled by the clustering (EuclideanClusterExtraction or RangeClustering)
+	std::vector<pcl::PointIndices> &clusters() { return clusters_; }
+	const std::vector<pcl::PointIndices> &clusters() const { return clusters_; }
+
+	size_t size() const { return clusters_.size(); }
+	bool empty() const { return clusters_.empty(); }
+	const std::vector<int> &indices(size_t k) const { return clusters_[k].indices; }
+	const PointT &point(int i) const { return cloud_->points[i]; }
+
+	Eigen::Vector4f centroid(size_t k) const
+	{
+		return centroid(indices(k));
+	}
+
+	// any subset of the cloud, e.g. the filtered points of one cluster
+	Eigen::Vector4f centroid(const std::vector<int> &subset) const
+	{
+		Eigen::Vector4f c(0.0, 0.0, 0.0, 0.0);
+		if(!subset.empty()) pcl::compute3DCentroid(*cloud_, subset, c);
+		return c;
+	}
+
+	void bounds(size_t k, Eigen::Vector4f &min_pt, Eigen::Vector4f &max_pt) const
+	{
+		pcl::getMinMax3D(*cloud_, indices(k), min_pt, max_pt);
+	}
+
+	// appends the points of the subset to out
+	void materialize(const std::vector<int> &subset, Cloud &out) const
+	{
+		out.points.reserve(out.points.size() + subset.size());
+		for(size_t j = 0; j < subset.size(); j++){
+			out.points.push_back(cloud_->points[subset[j]]);
+		}
+		out.width = out.points.size();
+		out.height = 1;
+	}
+
+	void materialize(size_t k, Cloud &out) const
+	{
+		materialize(indices(k), out);
+	}
+
+private:
+	CloudConstPtr cloud_;
+	std::vector<pcl::PointIndices> clusters_;
+};
+
+} // namespace clustering
+
+#endif /* CLUSTER_VIEW_H_ */
@@ -0,0 +1,290 @@
+/*
+ * ground_plane.h
+ *
+ * Ground plane of consecutive scans, warm started from the last frame.
+ *
+ * The result is the plane with the most inliers, as with SACSegmentation.
+ * The floor barely moves between two frames, so the plane found last time
+ * (or one fitted to the ground points of the height map for the same scan)
+ * is tried first. It is checked on a strided sample, and rejected as soon
+ * as the sampled inlier ratio is confidently below min_inlier_ratio. A plane
+ * that passes is scored on the whole cloud, refined by least squares on its
+ * inliers and becomes the starting best model of RANSAC. RANSAC keeps
+ * sampling until, with the given probability, no plane with more inliers
+ * can have been missed (the adaptive count of pcl::RandomSampleConsensus).
+ * A good start only shortens that count: at an inlier ratio w it is
+ * log(1 - p) / log(1 - w^3), e.g. 35 samples for w = 0.5 instead of 1000.
+ */
+
+#ifndef GROUND_PLANE_H_
+#define GROUND_PLANE_H_
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+
+#include <pcl/point_cloud.h>
+#include <pcl/PointIndices.h>
+#include <pcl/ModelCoefficients.h>
+
+namespace scan_preprocessing
+{
+
+struct GroundPlaneParams
+{
+	double distance_threshold;
+	// RANSAC, started from the hypothesis when there is one
+	int max_iterations;
+	double probability;
+	// a hypothesis has to explain this fraction of the cloud
+	double min_inlier_ratio;
+	// and its refined normal may not tilt more than this from the hypothesis
+	double max_tilt_deg;
+	// size of the strided sample of the early check, 0 : always score the full cloud
+	int verify_samples;
+
+	GroundPlaneParams() :
+		distance_threshold(0.1), max_iterations(1000), probability(0.99),
+		min_inlier_ratio(0.15), max_tilt_deg(5.0), verify_samples(200)
+	{
+	}
+};
+
+enum PlaneSource
+{
+	PLANE_NONE,      // no plane, inliers empty
+	PLANE_SEED,      // hypothesis given with setSeed / fitSeed, not beaten by RANSAC
+	PLANE_PREVIOUS,  // plane of the last frame, not beaten by RANSAC
+	PLANE_RANSAC     // a RANSAC sample had more inliers (or no hypothesis passed)
+};
+
+template<class PointT>
+class GroundPlane
+{
+public:
+	typedef pcl::PointCloud<PointT> Cloud;
+	typedef typename Cloud::ConstPtr CloudConstPtr;
+
+	explicit GroundPlane(const GroundPlaneParams &params = GroundPlaneParams()) :
+		params_(params), has_plane_(false), has_seed_(false)
+	{
+	}
+
+	void setParams(const GroundPlaneParams &params) { params_ = params; }
+	const GroundPlaneParams &params() const { return params_; }
+
+	// forget the last plane, the next frame runs RANSAC
+	void reset() { has_plane_ = false; has_seed_ = false; }
+
+	// hypothesis for the next segment() only, in place of the last plane
+	void setSeed(const Eigen::Vector4f &plane)
+	{
+		seed_ = plane;
+		has_seed_ = true;
+	}
+
+	// least squares plane of points known to be ground (height map labels)
+	template<class GroundT>
+	bool fitSeed(const pcl::PointCloud<GroundT> &ground)
+	{
+		Eigen::Vector4f plane;
+		std::vector<int> all(ground.points.size());
+		for(size_t i = 0; i < all.size(); i++) all[i] = i;
+		if(!fitPlane(ground, all, plane)) return false;
+		setSeed(plane);
+		return true;
+	}
+
+	PlaneSource segment(const CloudConstPtr &cloud, pcl::PointIndices &inliers, pcl::ModelCoefficients &coefficients)
+	{
+		inliers.indices.clear();
+		coefficients.values.clear();
+		PlaneSource source = PLANE_NONE;
+		Eigen::Vector4f plane;
+		if(cloud->points.size() < 3){
+			has_seed_ = false;
+			return PLANE_NONE;
+		}
+
+		if(has_seed_ && verify(*cloud, seed_, inliers.indices, plane)){
+			source = PLANE_SEED;
+		}
+		else if(has_plane_ && verify(*cloud, plane_, inliers.indices, plane)){
+			source = PLANE_PREVIOUS;
+		}
+		has_seed_ = false;
+		// a rejected hypothesis leaves its partial selection behind
+		if(source == PLANE_NONE) inliers.indices.clear();
+		if(ransac(*cloud, inliers.indices, plane)) source = PLANE_RANSAC;
+
+		if(source == PLANE_NONE){
+			inliers.indices.clear();
+			has_plane_ = false;
+			return source;
+		}
+		plane_ = plane;
+		has_plane_ = true;
+		coefficients.values.resize(4);
+		for(int k = 0; k < 4; k++) coefficients.values[k] = plane_(k);
+		return source;
+	}
+
+	bool hasPlane() const { return has_plane_; }
+	const Eigen::Vector4f &plane() const { return plane_; }
+
+private:
+	float distance(const PointT &p, const Eigen::Vector4f &plane) const
+	{
+		return fabs(plane(0) * p.x + plane(1) * p.y + plane(2) * p.z + plane(3));
+	}
+
+	/*
+	 * Early check on every (n / verify_samples)-th point: the plane is
+	 * rejected when even the upper 95 % bound of the sampled inlier ratio
+	 * stays below min_inlier_ratio. A plane that survives is scored on all
+	 * points, refined on its inliers and scored once more.
+	 */
+	bool verify(const Cloud &cloud, const Eigen::Vector4f &hypothesis,
+				std::vector<int> &inliers, Eigen::Vector4f &plane) const
+	{
+		size_t n = cloud.points.size();
+		if(params_.verify_samples > 0 && n > (size_t)(4 * params_.verify_samples)){
+			size_t step = n / params_.verify_samples;
+			int m = 0, hit = 0;
+			for(size_t i = 0; i < n; i += step, m++){
+				if(distance(cloud.points[i], hypothesis) < params_.distance_threshold) hit++;
+			}
+			double p = (double)hit / m;
+			if(p + 1.96 * sqrt(p * (1.0 - p) / m) < params_.min_inlier_ratio) return false;
+		}
+
+		select(cloud, hypothesis, inliers);
+		if(inliers.size() < params_.min_inlier_ratio * n) return false;
+
+		if(!fitPlane(cloud, inliers, plane)) return false;
+		double cos_tilt = fabs(plane.head<3>().dot(hypothesis.head<3>()));
+		if(cos_tilt < cos(params_.max_tilt_deg * M_PI / 180.0)) return false;
+		select(cloud, plane, inliers);
+		return inliers.size() >= params_.min_inlier_ratio * n;
+	}
+
+	// samples needed to hit an all-inlier triple with the given probability
+	double requiredIterations(size_t best, size_t n) const
+	{
+		double w = (double)best / n;
+		double miss = 1.0 - w * w * w;
+		if(miss <= 0.0) return 0.0;
+		if(miss >= 1.0) return params_.max_iterations;
+		return log(1.0 - params_.probability) / log(miss);
+	}
+
+	// inliers of plane, -1 as soon as it can no longer reach more than best
+	int count(const Cloud &cloud, const Eigen::Vector4f &plane, int best) const
+	{
+		int n = cloud.points.size();
+		int hit = 0;
+		for(int i = 0; i < n; i++){
+			if(distance(cloud.points[i], plane) < params_.distance_threshold) hit++;
+			else if(hit + (n - 1 - i) <= best) return -1;
+		}
+		return hit;
+	}
+
+	/*
+	 * RANSAC over planes through three points. inliers and plane hold the
+	 * best model so far (the verified hypothesis, or empty). Returns true if
+	 * a sample had more inliers; it is then refitted on them, as
+	 * SACSegmentation::setOptimizeCoefficients did.
+	 */
+	bool ransac(const Cloud &cloud, std::vector<int> &inliers, Eigen::Vector4f &plane)
+	{
+		int n = cloud.points.size();
+		int best = inliers.size();
+		bool found = false;
+		Eigen::Vector4f best_plane;
+		boost::random::uniform_int_distribution<int> pick(0, n - 1);
+
+		double needed = best > 0 ? requiredIterations(best, n) : params_.max_iterations;
+		for(int it = 0; it < params_.max_iterations && it < needed; it++){
+			int a = pick(rng_), b = pick(rng_), c = pick(rng_);
+			if(a == b || b == c || a == c) continue;
+			Eigen::Vector3f pa = cloud.points[a].getVector3fMap();
+			Eigen::Vector3f normal = (cloud.points[b].getVector3fMap() - pa).cross(cloud.points[c].getVector3fMap() - pa);
+			float len = normal.norm();
+			if(!(len > 1e-6f)) continue;
+			normal /= len;
+			Eigen::Vector4f sample;
+			sample.head<3>() = normal;
+			sample(3) = -normal.dot(pa);
+
+			int hit = count(cloud, sample, best);
+			if(hit <= best) continue;
+			best = hit;
+			best_plane = sample;
+			found = true;
+			needed = requiredIterations(best, n);
+		}
+		if(!found) return false;
+
+		std::vector<int> sample_inliers;
+		Eigen::Vector4f refined;
+		select(cloud, best_plane, sample_inliers);
+		if(!fitPlane(cloud, sample_inliers, refined)) return false;
+		select(cloud, refined, sample_inliers);
+		// the refit may lose inliers; keep the hypothesis if it is still larger
+		if(sample_inliers.size() <= inliers.size()) return false;
+		inliers.swap(sample_inliers);
+		plane = refined;
+		return true;
+	}
+
+	void select(const Cloud &cloud, const Eigen::Vector4f &plane, std::vector<int> &inliers) const
+	{
+		inliers.clear();
+		for(size_t i = 0; i < cloud.points.size(); i++){
+			if(distance(cloud.points[i], plane) < params_.distance_threshold) inliers.push_back(i);
+		}
+	}
+
+	// smallest eigenvector of the scatter, normal oriented upwards
+	template<class P>
+	static bool fitPlane(const pcl::PointCloud<P> &cloud, const std::vector<int> &indices, Eigen::Vector4f &plane)
+	{
+		if(indices.size() < 3) return false;
+		Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+		Eigen::Matrix3d sq = Eigen::Matrix3d::Zero();
+		for(size_t k = 0; k < indices.size(); k++){
+			const P &p = cloud.points[indices[k]];
+			Eigen::Vector3d v(p.x, p.y, p.z);
+			sum += v;
+			sq += v * v.transpose();
+		}
+		double n = indices.size();
+		Eigen::Vector3d c = sum / n;
+		Eigen::Matrix3d cov = sq / n - c * c.transpose();
+
+		Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es(cov);
+		Eigen::Vector3d normal = es.eigenvectors().col(0);
+		if(!(normal.norm() > 0.5)) return false;
+		if(normal(2) < 0.0) normal = -normal;
+		plane.head<3>() = normal.cast<float>();
+		plane(3) = -normal.dot(c);
+		return true;
+	}
+
+	GroundPlaneParams params_;
+	bool has_plane_;
+	Eigen::Vector4f plane_;
+	bool has_seed_;
+	Eigen::Vector4f seed_;
+	boost::random::mt19937 rng_;
+};
+
+} // namespace scan_preprocessing
+
+#endif /* GROUND_PLANE_H_ */
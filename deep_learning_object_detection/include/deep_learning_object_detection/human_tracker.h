@@ -0,0 +1,115 @@
+/*
+ * human_tracker.h
+ *
+ * Multi-target tracking of the cluster descriptors.
+ *
+ * Every track is a constant-velocity Kalman filter over (x, y, vx, vy).
+ * Per frame the tracks are predicted, their positions are put into a
+ * spatial hash with cells of the gate size, and each detection only looks
+ * at the 3 x 3 cells around it. The gated track/detection pairs split into
+ * small independent groups (connected components); the Hungarian method
+ * solves each group on its own, so the cost stays close to linear in the
+ * number of people instead of cubic in the whole scene.
+ */
+
+#ifndef HUMAN_TRACKER_H_
+#define HUMAN_TRACKER_H_
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+#include <Eigen/Core>
+
+namespace tracking
+{
+
+struct TrackerParams
+{
+	// association radius [m]
+	double gate;
+	// white noise acceleration of the motion model [m/s^2]
+	double accel_noise;
+	// position noise of a detection [m]
+	double meas_noise;
+	// velocity variance of a new track [(m/s)^2]
+	double init_vel_var;
+	// a track is reported after min_hits updates, dropped after max_misses
+	int min_hits;
+	int max_misses;
+	// longer gaps between frames drop every track [s]
+	double max_dt;
+
+	TrackerParams() :
+		gate(1.0), accel_noise(2.0), meas_noise(0.1), init_vel_var(1.0),
+		min_hits(3), max_misses(5), max_dt(1.0)
+	{
+	}
+};
+
+struct Detection
+{
+	double x, y, z;
+	// index of the source (descriptor) in its message
+	int index;
+};
+
+struct Track
+{
+	int id;
+	// x, y, vx, vy
+	Eigen::Vector4d x;
+	Eigen::Matrix4d P;
+	// height of the last matched detection, not filtered
+	double z;
+	int hits;
+	int misses;
+	// detection matched in the last update, -1 if none
+	int detection;
+};
+
+/*
+ * Minimum cost assignment of an n x m cost matrix (row major, n <= m),
+ * Hungarian method with potentials, O(n^2 m). assignment[row] = col.
+ */
+void solveAssignment(const std::vector<double> &cost, int n, int m, std::vector<int> &assignment);
+
+class HumanTracker
+{
+public:
+	explicit HumanTracker(const TrackerParams &params = TrackerParams());
+
+	void setParams(const TrackerParams &params) { params_ = params; }
+	const TrackerParams &params() const { return params_; }
+
+	// one frame of detections at time stamp [s]
+	void update(double stamp, const std::vector<Detection> &detections);
+
+	const std::vector<Track> &tracks() const { return tracks_; }
+	bool confirmed(const Track &track) const { return track.hits >= params_.min_hits; }
+
+private:
+	void predict(double dt);
+	void associate(const std::vector<Detection> &detections, std::vector<int> &track_of);
+	void correct(Track &track, const Detection &detection);
+	void solveGroup(const std::vector<int> &group_tracks, const std::vector<int> &group_detections,
+					const std::vector<Detection> &detections, std::vector<int> &track_of);
+
+	int64_t cellKey(double x, double y) const;
+	int find(int i);
+
+	TrackerParams params_;
+	std::vector<Track> tracks_;
+	int next_id_;
+	double last_stamp_;
+	bool initialized_;
+
+	// reused per frame
+	std::unordered_map<int64_t, std::vector<int> > cells_;
+	std::vector<int> parent_;
+	std::vector<int> edge_track_, edge_detection_;
+};
+
+} // namespace tracking
+
+#endif /* HUMAN_TRACKER_H_ */
@@ -0,0 +1,224 @@
+/*
+ * integral_moments.h
+ *
+ * Summed-area tables of point moments over a RangeImage.
+ *
+ * The count, the sums of x, y, z and the sums of their pairwise products over
+ * any ring x azimuth window come from four table lookups, so the cost of a
+ * window statistic does not depend on the window size. Depth discontinuities
+ * between adjacent pixels are kept in a second table, which lets a window be
+ * shrunk so that it never straddles two surfaces.
+ */
+
+#ifndef INTEGRAL_MOMENTS_H_
+#define INTEGRAL_MOMENTS_H_
+
+#include <algorithm>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <deep_learning_object_detection/range_image.h>
+
+namespace range_image
+{
+
+// double precision: the tables sum squared coordinates of a whole revolution
+struct Moments
+{
+	double n;
+	double x, y, z;
+	double xx, xy, xz, yy, yz, zz;
+
+	Moments()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		n = x = y = z = xx = xy = xz = yy = yz = zz = 0.0;
+	}
+
+	void add(double px, double py, double pz)
+	{
+		n += 1.0;
+		x += px; y += py; z += pz;
+		xx += px * px; xy += px * py; xz += px * pz;
+		yy += py * py; yz += py * pz; zz += pz * pz;
+	}
+
+	void operator +=(const Moments &o)
+	{
+		n += o.n;
+		x += o.x; y += o.y; z += o.z;
+		xx += o.xx; xy += o.xy; xz += o.xz;
+		yy += o.yy; yz += o.yz; zz += o.zz;
+	}
+
+	// a - b - c + d, the summed-area rectangle rule
+	void setRect(const Moments &a, const Moments &b, const Moments &c, const Moments &d)
+	{
+		n = a.n - b.n - c.n + d.n;
+		x = a.x - b.x - c.x + d.x;
+		y = a.y - b.y - c.y + d.y;
+		z = a.z - b.z - c.z + d.z;
+		xx = a.xx - b.xx - c.xx + d.xx;
+		xy = a.xy - b.xy - c.xy + d.xy;
+		xz = a.xz - b.xz - c.xz + d.xz;
+		yy = a.yy - b.yy - c.yy + d.yy;
+		yz = a.yz - b.yz - c.yz + d.yz;
+		zz = a.zz - b.zz - c.zz + d.zz;
+	}
+
+	// centroid and scatter matrix (sum of outer products about the centroid), n must be > 0
+	void centroidAndScatter(Eigen::Vector3f &centroid, Eigen::Matrix3f &scatter) const
+	{
+		Eigen::Vector3d mean(x / n, y / n, z / n);
+		Eigen::Matrix3d s;
+		s <<
+			xx, xy, xz,
+			xy, yy, yz,
+			xz, yz, zz;
+		s -= n * mean * mean.transpose();
+		centroid = mean.cast<float>();
+		scatter = s.cast<float>();
+	}
+};
+
+class IntegralMoments
+{
+public:
+	IntegralMoments() :
+		rows_(0), cols_(0)
+	{
+	}
+
+	/*
+	 * valid(i)     : pixel i takes part in the sums (missing returns, range limits)
+	 * h_edge(i, j) : depth discontinuity between pixel i and its right neighbour j
+	 * v_edge(i, j) : depth discontinuity between pixel i and the pixel j one ring above
+	 */
+	template<class Valid, class HEdge, class VEdge>
+	void compute(const RangeImage &img, Valid valid, HEdge h_edge, VEdge v_edge)
+	{
+		int rings = img.rings();
+		int cols = img.cols();
+		rows_ = rings + 1;
+		cols_ = cols + 1;
+		sat_.resize((size_t)rows_ * cols_);
+		edge_h_.resize((size_t)rows_ * cols_);
+		edge_v_.resize((size_t)rows_ * cols_);
+
+		for(int c = 0; c < cols_; c++){
+			sat_[c].clear();
+			edge_h_[c] = edge_v_[c] = 0;
+		}
+
+		// prefix sums along every ring
+#pragma omp parallel for
+		for(int r = 0; r < rings; r++){
+			size_t row = (size_t)(r + 1) * cols_;
+			Moments acc;
+			int acc_h = 0, acc_v = 0;
+			sat_[row].clear();
+			edge_h_[row] = edge_v_[row] = 0;
+			for(int c = 0; c < cols; c++){
+				int i = img.at(r, c);
+				if(valid(i)){
+					acc.add(img.x(i), img.y(i), img.z(i));
+				}
+				if(c + 1 < cols && h_edge(i, img.at(r, c + 1))){
+					acc_h++;
+				}
+				if(r + 1 < rings && v_edge(i, img.at(r + 1, c))){
+					acc_v++;
+				}
+				sat_[row + c + 1] = acc;
+				edge_h_[row + c + 1] = acc_h;
+				edge_v_[row + c + 1] = acc_v;
+			}
+		}
+
+		// then across the rings
+		for(int r = 2; r < rows_; r++){
+			size_t row = (size_t)r * cols_;
+			size_t prev = (size_t)(r - 1) * cols_;
+			for(int c = 1; c < cols_; c++){
+				sat_[row + c] += sat_[prev + c];
+				edge_h_[row + c] += edge_h_[prev + c];
+				edge_v_[row + c] += edge_v_[prev + c];
+			}
+		}
+	}
+
+	// moments over rings [r0, r1] x cols [c0, c1] (inclusive, inside the image)
+	void window(int r0, int r1, int c0, int c1, Moments &m) const
+	{
+		m.setRect(sat_[idx(r1 + 1, c1 + 1)], sat_[idx(r0, c1 + 1)], sat_[idx(r1 + 1, c0)], sat_[idx(r0, c0)]);
+	}
+
+	// number of discontinuities between pixels that both lie inside the window
+	int edges(int r0, int r1, int c0, int c1) const
+	{
+		int n = 0;
+		if(c1 > c0){
+			n += rect(edge_h_, r0, r1, c0, c1 - 1);
+		}
+		if(r1 > r0){
+			n += rect(edge_v_, r0, r1 - 1, c0, c1);
+		}
+		return n;
+	}
+
+	/*
+	 * Largest window around (ring, col), at most vnn rings and hnn columns to
+	 * each side, that does not cross a discontinuity. Each side is grown
+	 * independently, so an edge on the left doesn't shrink the right half.
+	 */
+	void edgeFreeWindow(int ring, int col, int hnn, int vnn, int &r0, int &r1, int &c0, int &c1) const
+	{
+		int rings = rows_ - 1;
+		int cols = cols_ - 1;
+
+		r0 = r1 = ring;
+		while(r1 < ring + vnn && r1 + 1 < rings && edges(ring, r1 + 1, col, col) == 0) r1++;
+		while(r0 > ring - vnn && r0 > 0 && edges(r0 - 1, ring, col, col) == 0) r0--;
+
+		// the window only ever loses edges when it shrinks, so the extents can be bisected
+		int lo = 0, hi = std::min(hnn, col);
+		while(lo < hi){
+			int mid = (lo + hi + 1) / 2;
+			if(edges(r0, r1, col - mid, col) == 0) lo = mid;
+			else hi = mid - 1;
+		}
+		c0 = col - lo;
+
+		lo = 0, hi = std::min(hnn, cols - 1 - col);
+		while(lo < hi){
+			int mid = (lo + hi + 1) / 2;
+			if(edges(r0, r1, col, col + mid) == 0) lo = mid;
+			else hi = mid - 1;
+		}
+		c1 = col + lo;
+	}
+
+protected:
+	size_t idx(int r, int c) const
+	{
+		return (size_t)r * cols_ + c;
+	}
+
+	int rect(const std::vector<int> &t, int r0, int r1, int c0, int c1) const
+	{
+		return t[idx(r1 + 1, c1 + 1)] - t[idx(r0, c1 + 1)] - t[idx(r1 + 1, c0)] + t[idx(r0, c0)];
+	}
+
+	int rows_, cols_;
+	std::vector<Moments> sat_;
+	std::vector<int> edge_h_, edge_v_;
+};
+
+} // namespace range_image
+
+#endif /* INTEGRAL_MOMENTS_H_ */
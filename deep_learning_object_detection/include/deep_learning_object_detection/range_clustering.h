@@ -0,0 +1,271 @@
+/*
+ * range_clustering.h
+ *
+ * Euclidean clustering on the ring x azimuth grid of a Velodyne scan.
+ *
+ * The input is unorganized, so every point is binned into its (ring, col)
+ * pixel by its direction. Two points are connected when they are closer
+ * than the tolerance, and only pixels whose angular distance could still
+ * allow that are visited: around a point at range d the window spans
+ * asin(tolerance / d) / resolution pixels. Every pixel of the window is
+ * tested, so the components are the ones of a radius search. Points closer
+ * than min_range (horizontally), where the window would grow to most of the
+ * image, are tested against every point within min_range + tolerance
+ * instead. Components are
+ * labelled with union-find, without any tree construction.
+ *
+ * Clusters are returned like pcl::EuclideanClusterExtraction: sizes in
+ * [min_size, max_size], indices ascending, clusters sorted by size.
+ */
+
+#ifndef RANGE_CLUSTERING_H_
+#define RANGE_CLUSTERING_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/PointIndices.h>
+
+#include <deep_learning_object_detection/range_image.h>
+
+namespace range_image
+{
+
+struct RangeClusteringParams
+{
+	SensorModel sensor;
+	// <= 0 : sensor default
+	float azimuth_res_deg;
+	float tolerance;
+	int min_size;
+	int max_size;
+	// [m] horizontal range below which a point is compared with every other
+	// point instead of a window; bounds the window, kept above the tolerance
+	float min_range;
+
+	RangeClusteringParams() :
+		sensor(HDL_32), azimuth_res_deg(0.0f),
+		tolerance(0.30f), min_size(10), max_size(25000),
+		min_range(1.0f)
+	{
+	}
+};
+
+class RangeClustering
+{
+public:
+	explicit RangeClustering(const RangeClusteringParams &params = RangeClusteringParams())
+	{
+		setParams(params);
+	}
+
+	void setParams(const RangeClusteringParams &params)
+	{
+		params_ = params;
+		params_.min_range = std::max(params_.min_range, 1.1f * params_.tolerance);
+		proj_.setSensorModel(params_.sensor, params_.azimuth_res_deg);
+		head_.assign((size_t)proj_.rings() * proj_.cols(), -1);
+		touched_.clear();
+	}
+
+	const RangeClusteringParams &params() const { return params_; }
+
+	template<class PointT>
+	void extract(const pcl::PointCloud<PointT> &cloud, std::vector<pcl::PointIndices> &clusters)
+	{
+		clusters.clear();
+		int n = cloud.points.size();
+		binPoints(cloud);
+
+		parent_.resize(n);
+		size_.assign(n, 1);
+		for(int i = 0; i < n; i++) parent_[i] = i;
+
+		float tol2 = params_.tolerance * params_.tolerance;
+		int rings = proj_.rings();
+		int cols = proj_.cols();
+		for(size_t k = 0; k < near_.size(); k++){
+			int i = near_[k];
+			int root = find(i);
+			for(size_t l = 0; l < band_.size(); l++){
+				if(band_[l] != i) root = link(root, i, band_[l], tol2);
+			}
+		}
+		for(int i = 0; i < n; i++){
+			if(ring_[i] < 0) continue;
+			float px = x_[i], py = y_[i], pz = z_[i];
+			int dc = halfWindow(std::sqrt(px * px + py * py), proj_.azimuthResolution());
+			int dr = halfWindow(std::sqrt(px * px + py * py + pz * pz), proj_.minRingSpacing());
+			// the window never needs to wrap onto itself
+			dc = std::min(dc, (cols - 1) / 2);
+
+			// own pixel, then the rest of the own ring and the rings above; the
+			// rings below see this point from their side
+			int root = find(i);
+			for(int j = next_[i]; j >= 0; j = next_[j]){
+				root = link(root, i, j, tol2);
+			}
+			int r_end = std::min(rings - 1, ring_[i] + dr);
+			for(int r = ring_[i]; r <= r_end; r++){
+				const int *row = &head_[r * cols];
+				if(r != ring_[i]){
+					for(int j = row[col_[i]]; j >= 0; j = next_[j]){
+						root = link(root, i, j, tol2);
+					}
+					root = walk(row, i, -1, dc, root, tol2);
+				}
+				root = walk(row, i, 1, dc, root, tol2);
+			}
+		}
+
+		// label the roots in index order, so the indices of a cluster come out sorted
+		std::vector<int> label(n, -1);
+		std::vector<pcl::PointIndices> all;
+		for(int i = 0; i < n; i++){
+			if(ring_[i] == INVALID) continue;
+			int root = find(i);
+			if(size_[root] < params_.min_size || size_[root] > params_.max_size) continue;
+			if(label[root] < 0){
+				label[root] = all.size();
+				all.push_back(pcl::PointIndices());
+				all.back().indices.reserve(size_[root]);
+			}
+			all[label[root]].indices.push_back(i);
+		}
+
+		std::stable_sort(all.begin(), all.end(), largerCluster);
+		clusters.swap(all);
+	}
+
+private:
+	// ring_ of points that are not binned
+	enum
+	{
+		INVALID = -1,  // not finite, left out like the kd-tree does
+		NEAR = -2      // closer than min_range, compared with band_ directly
+	};
+
+	/*
+	 * Pixels to each side that can hold a point within the tolerance: seen
+	 * from range d, a ball of radius tolerance spans asin(tolerance / d).
+	 * One more pixel absorbs the binning of points that were moved after the
+	 * scan (smoothing, calibration). d >= min_range > tolerance here.
+	 */
+	int halfWindow(float d, float resolution) const
+	{
+		return (int)(std::asin(params_.tolerance / d) / resolution) + 2;
+	}
+
+	// joins j to the set of i (root) if the two are within the tolerance
+	int link(int root, int i, int j, float tol2)
+	{
+		float dx = x_[i] - x_[j], dy = y_[i] - y_[j], dz = z_[i] - z_[j];
+		if(dx * dx + dy * dy + dz * dz < tol2 && find(j) != root){
+			return unite(root, j);
+		}
+		return root;
+	}
+
+	// links i to every point within the tolerance in the dc pixels on one side of its column
+	int walk(const int *row, int i, int dir, int dc, int root, float tol2)
+	{
+		int cols = proj_.cols();
+		int c = col_[i];
+		for(int k = 1; k <= dc; k++){
+			c += dir;
+			if(c < 0) c += cols;
+			else if(c >= cols) c -= cols;
+			for(int j = row[c]; j >= 0; j = next_[j]){
+				root = link(root, i, j, tol2);
+			}
+		}
+		return root;
+	}
+
+	static bool largerCluster(const pcl::PointIndices &a, const pcl::PointIndices &b)
+	{
+		return a.indices.size() > b.indices.size();
+	}
+
+	// per-pixel linked lists; only the pixels of the previous call are reset
+	template<class PointT>
+	void binPoints(const pcl::PointCloud<PointT> &cloud)
+	{
+		for(size_t k = 0; k < touched_.size(); k++){
+			head_[touched_[k]] = -1;
+		}
+		touched_.clear();
+
+		int n = cloud.points.size();
+		ring_.resize(n);
+		col_.resize(n);
+		next_.resize(n);
+		x_.resize(n);
+		y_.resize(n);
+		z_.resize(n);
+		near_.clear();
+		band_.clear();
+		int cols = proj_.cols();
+		float min_range2 = params_.min_range * params_.min_range;
+		float band2 = (params_.min_range + params_.tolerance) * (params_.min_range + params_.tolerance);
+		for(int i = 0; i < n; i++){
+			const PointT &p = cloud.points[i];
+			ring_[i] = INVALID;
+			next_[i] = -1;
+			x_[i] = p.x;
+			y_[i] = p.y;
+			z_[i] = p.z;
+			if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) continue;
+			if(p.x * p.x + p.y * p.y < band2) band_.push_back(i);
+			if(p.x * p.x + p.y * p.y < min_range2 || !proj_.project(p.x, p.y, p.z, ring_[i], col_[i])){
+				ring_[i] = NEAR;
+				near_.push_back(i);
+				continue;
+			}
+			int pix = ring_[i] * cols + col_[i];
+			if(head_[pix] < 0) touched_.push_back(pix);
+			next_[i] = head_[pix];
+			head_[pix] = i;
+		}
+	}
+
+	int find(int i)
+	{
+		while(parent_[i] != i){
+			parent_[i] = parent_[parent_[i]];
+			i = parent_[i];
+		}
+		return i;
+	}
+
+	// a must be a root, returns the root of the merged set
+	int unite(int a, int b)
+	{
+		b = find(b);
+		if(a == b) return a;
+		if(size_[a] < size_[b]) std::swap(a, b);
+		parent_[b] = a;
+		size_[a] += size_[b];
+		return a;
+	}
+
+	RangeClusteringParams params_;
+	SphericalProjection proj_;
+
+	std::vector<int> head_;
+	std::vector<int> touched_;
+	std::vector<int> next_;
+	// points closer than min_range, and the ones they can reach
+	std::vector<int> near_, band_;
+	std::vector<int> ring_, col_;
+	// coordinates packed for the neighbour loop
+	std::vector<float> x_, y_, z_;
+	std::vector<int> parent_;
+	std::vector<int> size_;
+};
+
+} // namespace range_image
+
+#endif /* RANGE_CLUSTERING_H_ */
@@ -0,0 +1,349 @@
+/*
+ * range_image.h
+ *
+ * Organized ring x azimuth view of one Velodyne revolution.
+ *
+ * The driver stores a revolution column by column, each column holding one
+ * firing of all lasers in firing order. RangeImage re-sorts every column by
+ * elevation once per scan, so that the neighbours of (ring, col) are found by
+ * plain index arithmetic instead of the per-sensor switch tables.
+ */
+
+#ifndef RANGE_IMAGE_H_
+#define RANGE_IMAGE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
+
+namespace range_image
+{
+
+// compile-time integer sequence (std::integer_sequence is c++14)
+template<int... Is> struct IndexSeq {};
+template<int N, int... Is> struct MakeIndexSeq : MakeIndexSeq<N - 1, N - 1, Is...> {};
+template<int... Is> struct MakeIndexSeq<0, Is...> { typedef IndexSeq<Is...> type; };
+
+/*
+ * Firing order of the Velodyne sensors.
+ * Inside a block the lasers alternate between the lower and the upper half of
+ * the vertical field of view (HDL-32: -30.67, -9.33, -29.33, -8.00, ... deg).
+ * Blocks fire from the top, i.e. the HDL-64 upper block holds lasers 0-31.
+ * ring 0 is the lowest laser.
+ */
+template<int RINGS_, int BLOCKS_>
+struct InterleavedLaserOrder
+{
+	static const int RINGS = RINGS_;
+	static const int BLOCKS = BLOCKS_;
+	static const int PER_BLOCK = RINGS_ / BLOCKS_;
+	static const int HALF = PER_BLOCK / 2;
+
+	// ring -> position of the laser in a firing column
+	static constexpr int firing(int ring)
+	{
+		return (BLOCKS - 1 - ring / PER_BLOCK) * PER_BLOCK
+			+ ((ring % PER_BLOCK) < HALF ? 2 * (ring % PER_BLOCK) : 2 * (ring % PER_BLOCK - HALF) + 1);
+	}
+
+	// position in a firing column -> ring
+	static constexpr int ring(int firing)
+	{
+		return (BLOCKS - 1 - firing / PER_BLOCK) * PER_BLOCK
+			+ ((firing % PER_BLOCK) % 2 == 0 ? (firing % PER_BLOCK) / 2 : (firing % PER_BLOCK) / 2 + HALF);
+	}
+};
+
+struct HDL32 : InterleavedLaserOrder<32, 1> {};
+struct VLP16 : InterleavedLaserOrder<16, 1> {};
+// nominal layout; units with a measured db.yaml may deviate inside a block
+struct HDL64 : InterleavedLaserOrder<64, 2> {};
+
+// lookup tables generated from the order functions at compile time
+template<class Sensor, class Seq = typename MakeIndexSeq<Sensor::RINGS>::type>
+struct LaserTable;
+
+template<class Sensor, int... Is>
+struct LaserTable<Sensor, IndexSeq<Is...> >
+{
+	static constexpr int ring_to_firing[sizeof...(Is)] = { Sensor::firing(Is)... };
+	static constexpr int firing_to_ring[sizeof...(Is)] = { Sensor::ring(Is)... };
+};
+
+template<class Sensor, int... Is>
+constexpr int LaserTable<Sensor, IndexSeq<Is...> >::ring_to_firing[sizeof...(Is)];
+template<class Sensor, int... Is>
+constexpr int LaserTable<Sensor, IndexSeq<Is...> >::firing_to_ring[sizeof...(Is)];
+
+// same order as the old itr()/itr_inv() tables of the normal estimator
+static_assert(LaserTable<HDL32>::ring_to_firing[1] == 2, "HDL-32 laser order");
+static_assert(LaserTable<HDL32>::ring_to_firing[16] == 1, "HDL-32 laser order");
+static_assert(LaserTable<HDL32>::firing_to_ring[3] == 17, "HDL-32 laser order");
+static_assert(LaserTable<HDL64>::ring_to_firing[63] == 31, "HDL-64 laser order");
+
+typedef enum
+{
+	HDL_32, VLP_16, HDL_64
+} SensorModel;
+
+inline bool sensorModelFromString(const std::string &s, SensorModel &model)
+{
+	if(s == "HDL-32" || s == "HDL32" || s == "HDL-32E"){
+		model = HDL_32;
+	}
+	else if(s == "VLP-16" || s == "VLP16"){
+		model = VLP_16;
+	}
+	else if(s == "HDL-64" || s == "HDL64" || s == "HDL-64E"){
+		model = HDL_64;
+	}
+	else{
+		return false;
+	}
+	return true;
+}
+
+inline int sensorRings(SensorModel model)
+{
+	switch(model){
+		case VLP_16: return VLP16::RINGS;
+		case HDL_64: return HDL64::RINGS;
+		case HDL_32:
+		default: return HDL32::RINGS;
+	}
+}
+
+// nominal vertical angle of a ring [deg], increasing with the ring index
+inline float laserElevationDeg(SensorModel model, int ring)
+{
+	switch(model){
+		case VLP_16:
+			return -15.0f + 2.0f * ring;
+		case HDL_64:
+			// lower block 0.5 deg apart, upper block 1/3 deg apart
+			return ring < 32 ? -24.33f + 0.5f * ring : -8.33f + (ring - 32) / 3.0f;
+		case HDL_32:
+		default:
+			return -30.67f + 4.0f / 3.0f * ring;
+	}
+}
+
+// angle between two firings at the usual 10 Hz [deg]
+inline float azimuthResolutionDeg(SensorModel model)
+{
+	switch(model){
+		case VLP_16: return 0.2f;
+		case HDL_64: return 0.1728f;
+		case HDL_32:
+		default: return 0.1658f;
+	}
+}
+
+/*
+ * (ring, col) of arbitrary points from their direction, for clouds that lost
+ * the scan order on the way (filtered subsets, merged clouds).
+ */
+class SphericalProjection
+{
+public:
+	explicit SphericalProjection(SensorModel model = HDL_32, float azimuth_res_deg = 0.0f)
+	{
+		setSensorModel(model, azimuth_res_deg);
+	}
+
+	// azimuth_res_deg <= 0 uses the sensor default
+	void setSensorModel(SensorModel model, float azimuth_res_deg = 0.0f)
+	{
+		rings_ = sensorRings(model);
+		std::vector<float> el(rings_);
+		for(int r = 0; r < rings_; r++){
+			el[r] = laserElevationDeg(model, r) * M_PI / 180.0;
+		}
+		tan_elevation_.resize(rings_);
+		tan_boundary_.resize(rings_ - 1);
+		min_spacing_ = M_PI;
+		for(int r = 0; r < rings_; r++){
+			tan_elevation_[r] = tan(el[r]);
+			if(r == 0) continue;
+			tan_boundary_[r - 1] = tan(0.5 * (el[r - 1] + el[r]));
+			min_spacing_ = std::min(min_spacing_, el[r] - el[r - 1]);
+		}
+		if(azimuth_res_deg <= 0.0f) azimuth_res_deg = azimuthResolutionDeg(model);
+		cols_ = (int)(360.0f / azimuth_res_deg + 0.5f);
+		azimuth_res_ = 2.0 * M_PI / cols_;
+	}
+
+	int rings() const { return rings_; }
+	int cols() const { return cols_; }
+	// [rad]
+	float azimuthResolution() const { return azimuth_res_; }
+	float minRingSpacing() const { return min_spacing_; }
+
+	// false for points at the origin
+	bool project(float x, float y, float z, int &ring, int &col) const
+	{
+		float xy = std::sqrt(x * x + y * y);
+		if(xy <= 0.0f) return false;
+
+		// nearest laser, compared on tan(elevation) to save an atan2
+		float t = z / xy;
+		int hi = std::lower_bound(tan_elevation_.begin(), tan_elevation_.end(), t) - tan_elevation_.begin();
+		if(hi == 0) ring = 0;
+		else if(hi == rings_) ring = rings_ - 1;
+		else ring = (t - tan_boundary_[hi - 1] < 0.0f) ? hi - 1 : hi;
+
+		float az = std::atan2(y, x);
+		if(az < 0.0f) az += 2.0f * (float)M_PI;
+		col = (int)(az / azimuth_res_);
+		if(col >= cols_) col -= cols_;
+		return true;
+	}
+
+	int wrap(int col) const { return ((col % cols_) + cols_) % cols_; }
+
+protected:
+	int rings_;
+	int cols_;
+	float azimuth_res_;
+	float min_spacing_;
+	std::vector<float> tan_elevation_;
+	// tan of the elevation halfway between ring r and r + 1
+	std::vector<float> tan_boundary_;
+};
+
+class RangeImage
+{
+public:
+	explicit RangeImage(SensorModel model = HDL_32) :
+		cols_(0), has_rgb_(false)
+	{
+		setSensorModel(model);
+	}
+
+	void setSensorModel(SensorModel model)
+	{
+		switch(model){
+			case VLP_16:
+				rings_ = VLP16::RINGS;
+				ring_to_firing_ = LaserTable<VLP16>::ring_to_firing;
+				firing_to_ring_ = LaserTable<VLP16>::firing_to_ring;
+				break;
+			case HDL_64:
+				rings_ = HDL64::RINGS;
+				ring_to_firing_ = LaserTable<HDL64>::ring_to_firing;
+				firing_to_ring_ = LaserTable<HDL64>::firing_to_ring;
+				break;
+			case HDL_32:
+			default:
+				rings_ = HDL32::RINGS;
+				ring_to_firing_ = LaserTable<HDL32>::ring_to_firing;
+				firing_to_ring_ = LaserTable<HDL32>::firing_to_ring;
+				break;
+		}
+	}
+
+	/*
+	 * Re-sorts one revolution (columns of rings() points in firing order).
+	 * A trailing incomplete column is padded with missing pixels.
+	 * A packed "rgb"/"rgba" field is copied along when the cloud has one.
+	 * Returns false if the cloud has no FLOAT32 x, y, z fields.
+	 */
+	bool build(const sensor_msgs::PointCloud2 &msg)
+	{
+		int off_x = -1, off_y = -1, off_z = -1, off_rgb = -1;
+		for(size_t i = 0; i < msg.fields.size(); i++){
+			if((msg.fields[i].name == "rgb" || msg.fields[i].name == "rgba")
+					&& (msg.fields[i].datatype == sensor_msgs::PointField::FLOAT32
+						|| msg.fields[i].datatype == sensor_msgs::PointField::UINT32)){
+				off_rgb = msg.fields[i].offset;
+			}
+			if(msg.fields[i].datatype != sensor_msgs::PointField::FLOAT32){
+				continue;
+			}
+			if(msg.fields[i].name == "x") off_x = msg.fields[i].offset;
+			if(msg.fields[i].name == "y") off_y = msg.fields[i].offset;
+			if(msg.fields[i].name == "z") off_z = msg.fields[i].offset;
+		}
+		if(off_x < 0 || off_y < 0 || off_z < 0){
+			cols_ = 0;
+			return false;
+		}
+
+		size_t npoints = (size_t)msg.width * msg.height;
+		cols_ = (npoints + rings_ - 1) / rings_;
+		size_t sz = (size_t)rings_ * cols_;
+		x_.resize(sz);
+		y_.resize(sz);
+		z_.resize(sz);
+		range_.resize(sz);
+		source_.resize(sz);
+		has_rgb_ = (off_rgb >= 0);
+		rgb_.resize(has_rgb_ ? sz : 0);
+
+		for(int c = 0; c < cols_; c++){
+			for(int f = 0; f < rings_; f++){
+				size_t src = (size_t)c * rings_ + f;
+				int i = at(firing_to_ring_[f], c);
+				if(src >= npoints){
+					x_[i] = y_[i] = z_[i] = range_[i] = 0.0f;
+					source_[i] = -1;
+					if(has_rgb_) rgb_[i] = 0;
+					continue;
+				}
+				const uint8_t *pt = &msg.data[src * msg.point_step];
+				memcpy(&x_[i], pt + off_x, sizeof(float));
+				memcpy(&y_[i], pt + off_y, sizeof(float));
+				memcpy(&z_[i], pt + off_z, sizeof(float));
+				range_[i] = sqrt(x_[i] * x_[i] + y_[i] * y_[i] + z_[i] * z_[i]);
+				source_[i] = src;
+				if(has_rgb_) memcpy(&rgb_[i], pt + off_rgb, sizeof(uint32_t));
+			}
+		}
+		return true;
+	}
+
+	int rings() const { return rings_; }
+	int cols() const { return cols_; }
+	size_t size() const { return (size_t)rings_ * cols_; }
+
+	// rings are contiguous along the azimuth
+	int at(int ring, int col) const { return ring * cols_ + col; }
+	int ringOf(int i) const { return i / cols_; }
+	int colOf(int i) const { return i % cols_; }
+	// azimuth index modulo one revolution
+	int wrap(int col) const { return ((col % cols_) + cols_) % cols_; }
+
+	int firingIndex(int ring) const { return ring_to_firing_[ring]; }
+	int ringOfFiring(int firing) const { return firing_to_ring_[firing]; }
+
+	float x(int i) const { return x_[i]; }
+	float y(int i) const { return y_[i]; }
+	float z(int i) const { return z_[i]; }
+	float range(int i) const { return range_[i]; }
+	// index of the point in the source cloud, -1 if the pixel is missing
+	int source(int i) const { return source_[i]; }
+
+	bool hasRgb() const { return has_rgb_; }
+	// packed 0x00RRGGBB as in pcl, only if hasRgb()
+	uint32_t rgb(int i) const { return rgb_[i]; }
+
+protected:
+	int rings_;
+	int cols_;
+	const int *ring_to_firing_;
+	const int *firing_to_ring_;
+
+	std::vector<float> x_, y_, z_, range_;
+	std::vector<int> source_;
+	bool has_rgb_;
+	std::vector<uint32_t> rgb_;
+};
+
+} // namespace range_image
+
+#endif /* RANGE_IMAGE_H_ */
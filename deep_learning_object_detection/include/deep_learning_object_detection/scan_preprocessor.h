@@ -0,0 +1,138 @@
+/*
+ * scan_preprocessor.h
+ *
+ * Fused per-scan preprocessing of an organized Velodyne revolution.
+ *
+ * The message is read once into a RangeImage; every later stage works on
+ * the per-pixel arrays of that image instead of a deserialized pcl cloud.
+ * One run produces the range/crop validity, ring-window normals (from the
+ * integral moments), the height-map cell of every point and the
+ * ground/obstacle labels of the height map. The topics of the normal
+ * estimator, the height map and the range constraint node are all views
+ * of these arrays.
+ */
+
+#ifndef SCAN_PREPROCESSOR_H_
+#define SCAN_PREPROCESSOR_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include <sensor_msgs/PointCloud2.h>
+
+#include <deep_learning_object_detection/range_image.h>
+#include <deep_learning_object_detection/integral_moments.h>
+
+namespace scan_preprocessing
+{
+
+// per-pixel flags
+enum
+{
+	VALID = 1 << 0,       // range inside [min_range, max_range]
+	HAS_NORMAL = 1 << 1,  // enough edge-free neighbours for a normal
+	GROUND = 1 << 2,      // height map cell without obstacle ("clear")
+	OBSTACLE = 1 << 3     // height map cell with an obstacle
+};
+
+struct PreprocessParams
+{
+	range_image::SensorModel sensor;
+	float min_range;
+	float max_range;
+	// leading fraction of the revolution (in columns) that gets normals
+	float view_ratio;
+
+	int hnn;
+	int vnn;
+	float thresh_d;
+	float vector_vertical;
+	float dens;
+	// move points along their normal towards the local plane
+	bool smoothing;
+
+	int grid_dim;
+	double cell_size;
+	double height_threshold;
+	double max_height_diff;
+	double max_obstacle_z;
+
+	PreprocessParams() :
+		sensor(range_image::HDL_32),
+		min_range(2.2f), max_range(120.0f), view_ratio(1.0f),
+		hnn(3), vnn(1), thresh_d(0.2f), vector_vertical(1.5f), dens(0.5f),
+		smoothing(true),
+		grid_dim(800), cell_size(0.1), height_threshold(0.15),
+		max_height_diff(3.0), max_obstacle_z(1.2)
+	{
+	}
+};
+
+// structure of arrays indexed like the range image pixels
+struct ScanAttributes
+{
+	std::vector<uint8_t> flags;
+	// refined position (the raw one if smoothing is off)
+	std::vector<float> px, py, pz;
+	// unit normal, same sign as the normal estimator publishes
+	std::vector<float> nx, ny, nz;
+	std::vector<float> curvature;
+	// height map cell, -1 outside the grid
+	std::vector<int> cell;
+
+	void resize(size_t n)
+	{
+		flags.resize(n);
+		px.resize(n); py.resize(n); pz.resize(n);
+		nx.resize(n); ny.resize(n); nz.resize(n);
+		curvature.resize(n);
+		cell.resize(n);
+	}
+};
+
+class ScanPreprocessor
+{
+public:
+	explicit ScanPreprocessor(const PreprocessParams &params = PreprocessParams());
+
+	void setParams(const PreprocessParams &params);
+	const PreprocessParams &params() const { return params_; }
+
+	// runs every stage on one revolution, false if the cloud has no x, y, z
+	bool process(const sensor_msgs::PointCloud2 &msg);
+
+	const range_image::RangeImage &image() const { return img_; }
+	const ScanAttributes &attributes() const { return attr_; }
+
+	size_t size() const { return img_.size(); }
+	bool is(size_t i, uint8_t flag) const { return (attr_.flags[i] & flag) != 0; }
+
+private:
+	bool classifyPixel(int i);
+	int cellOf(float x, float y) const;
+	void estimateNormals();
+	void buildHeightMap();
+	void labelPixels();
+
+	bool validRange(float r) const
+	{
+		return r > params_.min_range && r < params_.max_range;
+	}
+	bool hEdge(int i, int j) const;
+	bool vEdge(int i, int j) const;
+
+	PreprocessParams params_;
+	range_image::RangeImage img_;
+	range_image::IntegralMoments moments_;
+	ScanAttributes attr_;
+
+	// height map, only the cells touched by the last scan are reset
+	std::vector<float> cell_min_;
+	std::vector<float> cell_max_;
+	std::vector<uint8_t> cell_init_;
+	std::vector<int> touched_;
+};
+
+} // namespace scan_preprocessing
+
+#endif /* SCAN_PREPROCESSOR_H_ */
@@ -158,13 +158,15 @@ class image_converter:
             #  bbox_array = np.array([x1, y1, x2, y2], dtype=np.int32)
             #  Int32MultiArray(bbox_array).data = [x1, y1, x2, y2]
             #  bbox_array.layout.dim = [1]
-            bbox_array.data = [x1, y1, x2, y2]
-            print "bbox_array : ", bbox_array
+            #  all boxes in one message, 4 values per box
+            bbox_array.data.extend([x1, y1, x2, y2])
             cv.rectangle(out, (x1, y1), (x2, y2), (0, 0, 255), 2, CV_AA)
             ret, baseline = cv.getTextSize(CLASSES[cls_id], cv.FONT_HERSHEY_SIMPLEX, 0.8, 1)
             cv.rectangle(out, (x1, y2 - ret[1] - baseline),(x1 + ret[0], y2), (0, 0, 255), -1)
             cv.putText(out, CLASSES[cls_id], (x1, y2 - baseline), cv.FONT_HERSHEY_SIMPLEX, 0.8, (255, 255, 255), 1, CV_AA)
 
+        if len(bbox_array.data) > 0:
+            print "bbox_array : ", bbox_array
             self.bbox_pub.publish(bbox_array)
 
         return out
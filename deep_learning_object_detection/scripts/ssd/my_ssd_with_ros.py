@@ -102,13 +102,13 @@ class image_converter:
 
         cand = utils.draw.detect(prior, loc, conf)
         #  utils.draw.draw(image, cand, args.name)
-        result, x1, y1, x2, y2, bbox_pub_flag = utils.draw.cv_draw(orig_image, cand)
+        result, boxes = utils.draw.cv_draw(orig_image, cand)
         print "cand : ", cand
-        if bbox_pub_flag:
-            print "x1 : ", x1, "\t y1 : ", y1, "\t x2 : ", x2, "\t y2 : ", y2
+        if len(boxes) > 0:
+            print "boxes : ", boxes
 
             bbox_array = Int32MultiArray()
-            bbox_array.data = [x1, y1, x2, y2]
+            bbox_array.data = boxes
             self.bbox_pub.publish(bbox_array)
         
         self.image_pub.publish(self.bridge.cv2_to_imgmsg(result, "bgr8"))
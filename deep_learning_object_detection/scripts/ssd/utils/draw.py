@@ -51,15 +51,11 @@ def draw(image, cand, f_name=None):
 
 def cv_draw(image, cand, f_name=None):
     result_image = copy.deepcopy(image)
-    x1 = 0
-    y1 = 0
-    x2 = 0
-    y2 = 0
-    pub_flag = False
+    #  4 values per box, all detected people
+    boxes = []
     for i in cand:
         label, conf, x1, y1, x2, y2 = i
         if label == 15:
-            pub_flag = True
             label = int(label) - 1
             x1 = int(round(x1 * image.shape[1]))
             x2 = int(round(x2 * image.shape[1]))
@@ -69,6 +65,7 @@ def cv_draw(image, cand, f_name=None):
             print "label_name : ", label_name
             print "x1 : ", x1, ", y1 : ", y1
             print "x2 : ", x2, ", y2 : ", y2
+            boxes.extend([x1, y1, x2, y2])
             cv.rectangle(result_image, (x1, y1), (x2, y2), (0, 0, 255), 2, cv.CV_AA)
 
             display_txt = '%s: %.2f' % (label_name, conf)
@@ -77,5 +74,5 @@ def cv_draw(image, cand, f_name=None):
             cv.rectangle(result_image, (x1, y2 - ret[1] - baseline), (x1 + ret[0], y2), (0, 0, 255), -1)
             cv.putText(result_image, display_txt, (x1, y2 - baseline), cv.FONT_HERSHEY_SIMPLEX, 0.5, (255, 255, 255), 1, cv.CV_AA)
 
-    return result_image, x1, y1, x2, y2, pub_flag
+    return result_image, boxes
 
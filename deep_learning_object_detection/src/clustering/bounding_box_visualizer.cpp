@@ -12,18 +12,24 @@
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
 
+#include <deep_learning_object_detection/cluster_descriptor.h>
+
 using namespace std;
 
 typedef pcl::PointXYZRGBNormal PointType;
 typedef pcl::PointCloud<PointType> CloudType;
+typedef pcl::PointCloud<clustering::ClusterDescriptor> DescriptorCloud;
 
 ros::Publisher pub_min_points;
 ros::Publisher pub_max_points;
 ros::Publisher pub_bbox;
 
-void create_bbox_marker(vector< vector<float> > minmax_list, 
-						std_msgs::Header marker_header, 
-						visualization_msgs::Marker &marker)
+// boxes of every cluster instead of the human only
+bool all_clusters = false;
+// oriented boxes instead of axis-aligned ones
+bool oriented = false;
+
+void init_bbox_marker(const std_msgs::Header &marker_header, visualization_msgs::Marker &marker)
 {
 	marker.header = marker_header;
 	marker.ns = "bbox";
@@ -40,49 +46,25 @@ void create_bbox_marker(vector< vector<float> > minmax_list,
 	marker.color.g = 1.0;
 	marker.color.b = 0.0;
 	marker.color.a = 1.0;
+}
 
-	// set bbox vertex
-	vector<geometry_msgs::Point> plane_vertex_list(4);
-
-	geometry_msgs::Point p1;
-	p1.x = minmax_list[0][0];
-	p1.y = minmax_list[0][1];
-	p1.z = minmax_list[0][2];
-	plane_vertex_list[0] = p1;
-
-	geometry_msgs::Point p2;
-	p2.x = minmax_list[0][0];
-	p2.y = minmax_list[1][1];
-	p2.z = minmax_list[0][2];
-	plane_vertex_list[1] = p2;
-
-	geometry_msgs::Point p3;
-	p3.x = minmax_list[1][0];
-	p3.y = minmax_list[1][1];
-	p3.z = minmax_list[0][2];
-	plane_vertex_list[2] = p3;
-
-	geometry_msgs::Point p4;
-	p4.x = minmax_list[1][0];
-	p4.y = minmax_list[0][1];
-	p4.z = minmax_list[0][2];
-	plane_vertex_list[3] = p4;
-
+// appends the 12 edges of the box over the 4 base corners (at min_z) to the marker
+void add_bbox_lines(const vector<geometry_msgs::Point> &plane_vertex_list, float max_z,
+					visualization_msgs::Marker &marker)
+{
 	vector< vector<geometry_msgs::Point> > vertex_list(2, plane_vertex_list);
 	for(size_t i = 0; i < vertex_list[1].size(); i++){
-		vertex_list[1][i].z = minmax_list[1][2];
+		vertex_list[1][i].z = max_z;
 	}
 
 	// create xy-plane at minimum z and maximum z
 	for(size_t i = 0; i < vertex_list.size(); i++){
 		for(size_t j = 0; j < vertex_list[i].size(); j++){
 			marker.points.push_back(vertex_list[i][j]);
-			// cout<<"j : "<<j<<endl;
 			size_t k = j + 1;
 			if(k >= vertex_list[i].size()){
 				k = 0;
 			}
-			// cout<<"j + 1 : "<<k<<endl;
 			marker.points.push_back(vertex_list[i][k]);
 		}
 	}
@@ -94,102 +76,72 @@ void create_bbox_marker(vector< vector<float> > minmax_list,
 	}
 }
 
-void coloring_minmax_point(CloudType::Ptr input_cloud, 
-						   CloudType::Ptr min_points, 
-						   CloudType::Ptr max_points, 
-						   vector< vector<int> > minmax_index_list)
+void add_bbox(const clustering::ClusterDescriptor &d, visualization_msgs::Marker &marker)
 {
-	for(size_t i = 0; i < minmax_index_list.size(); i++){
-		for(size_t j = 0; j < minmax_index_list[i].size(); j++){
-			PointType tmp;
-			tmp = input_cloud->points[minmax_index_list[i][j]];
-			if(i == 0){
-				tmp.r = 255;
-				tmp.g = 255;
-				tmp.b = 0;
-				min_points->points.push_back(tmp);
-			}
-			else if(i == 1){
-				tmp.r = 0;
-				tmp.g = 255;
-				tmp.b = 255;
-				max_points->points.push_back(tmp);
-			}
+	vector<geometry_msgs::Point> plane_vertex_list(4);
+	if(oriented){
+		// corners of the oriented box, +-length along yaw and +-width across
+		float c = cos(d.yaw), s = sin(d.yaw);
+		const float sign[4][2] = {{-1, -1}, {-1, 1}, {1, 1}, {1, -1}};
+		for(size_t i = 0; i < 4; i++){
+			float u = 0.5 * d.length * sign[i][0];
+			float v = 0.5 * d.width * sign[i][1];
+			plane_vertex_list[i].x = d.obb_x + u * c - v * s;
+			plane_vertex_list[i].y = d.obb_y + u * s + v * c;
+			plane_vertex_list[i].z = d.min_z;
 		}
 	}
-}
-
-void search_xyz_minmax(CloudType::Ptr input_cloud, 
-					   vector< vector<float> > &minmax_list, 
-					   vector< vector<int> > &minmax_index_list)
-{
-	minmax_list.resize(2);
-	for(size_t i = 0; i < minmax_list.size(); i++){
-		minmax_list[i].resize(3);
-		minmax_list[i][0] = input_cloud->points[0].x;
-		minmax_list[i][1] = input_cloud->points[0].y;
-		minmax_list[i][2] = input_cloud->points[0].z;
-	}
-	minmax_index_list = vector< vector<int> >(2, vector<int>(3, 0));
-
-	size_t input_cloud_size = input_cloud->points.size();
-	for(size_t i = 1; i < input_cloud_size; i++){
-		vector<float> xyz_point(3);
-		xyz_point[0] = input_cloud->points[i].x;
-		xyz_point[1] = input_cloud->points[i].y;
-		xyz_point[2] = input_cloud->points[i].z;
-		for(size_t j = 0; j < xyz_point.size(); j++){
-			if(xyz_point[j] < minmax_list[0][j]){
-				minmax_list[0][j] = xyz_point[j];
-				minmax_index_list[0][j] = i;
-			}
-			if(xyz_point[j] > minmax_list[1][j]){
-				minmax_list[1][j] = xyz_point[j];
-				minmax_index_list[1][j] = i;
-			}
-		}
+	else{
+		plane_vertex_list[0].x = d.min_x; plane_vertex_list[0].y = d.min_y;
+		plane_vertex_list[1].x = d.min_x; plane_vertex_list[1].y = d.max_y;
+		plane_vertex_list[2].x = d.max_x; plane_vertex_list[2].y = d.max_y;
+		plane_vertex_list[3].x = d.max_x; plane_vertex_list[3].y = d.min_y;
+		for(size_t i = 0; i < 4; i++) plane_vertex_list[i].z = d.min_z;
 	}
-
-	// cout<<"i --> (0 : min, 1 : max)\tj --> (0 : x, 1 : y, 2 : y)"<<endl;
-	// for(size_t i = 0; i < minmax_list.size(); i++){
-		// for(size_t j = 0; j < minmax_list[i].size(); j++){
-			// cout<<"minmax_list["<<i<<"]["<<j<<"] : "<<minmax_list[i][j]<<endl;
-		// }
-	// }
-	// for(size_t i = 0; i < minmax_index_list.size(); i++){
-		// for(size_t j = 0; j < minmax_index_list[i].size(); j++){
-			// cout<<"minmax_index_list["<<i<<"]["<<j<<"] : "<<minmax_index_list[i][j]<<endl;
-		// }
-	// }
+	add_bbox_lines(plane_vertex_list, d.max_z, marker);
 }
 
-void calculate_centroid(CloudType input_cloud, PointType *centroid_point)
+// min and max corner of the axis-aligned box
+void add_minmax_point(const clustering::ClusterDescriptor &d, CloudType::Ptr min_points, CloudType::Ptr max_points)
 {
-	Eigen::Vector4f xyz_centroid(0.0, 0.0, 0.0, 0.0);
-	pcl::compute3DCentroid(input_cloud, xyz_centroid);
-	centroid_point->x = xyz_centroid[0];
-	centroid_point->y = xyz_centroid[1];
-	centroid_point->z = xyz_centroid[2];
+	PointType tmp;
+	tmp.x = d.min_x;
+	tmp.y = d.min_y;
+	tmp.z = d.min_z;
+	tmp.r = 255;
+	tmp.g = 255;
+	tmp.b = 0;
+	min_points->points.push_back(tmp);
+
+	tmp.x = d.max_x;
+	tmp.y = d.max_y;
+	tmp.z = d.max_z;
+	tmp.r = 0;
+	tmp.g = 255;
+	tmp.b = 255;
+	max_points->points.push_back(tmp);
 }
 
-void humanPointsCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
+void descriptorsCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
 {
-	CloudType::Ptr pointcloud (new CloudType);
-	pcl::fromROSMsg(*msg, *pointcloud);
-	cout<<"pointcloud->points.size() : "<<pointcloud->points.size()<<endl;
-
-	if(pointcloud->points.size() == 0){
-		ROS_ERROR("msg is empty.");
-		return;
-	}
-
-	vector< vector<float> > minmax_list;
-	vector< vector<int> > minmax_index_list;
-	search_xyz_minmax(pointcloud, minmax_list, minmax_index_list);
+	DescriptorCloud descriptors;
+	pcl::fromROSMsg(*msg, descriptors);
 
+	visualization_msgs::Marker bbox_marker;
+	init_bbox_marker(msg->header, bbox_marker);
 	CloudType::Ptr min_points (new CloudType);
 	CloudType::Ptr max_points (new CloudType);
-	coloring_minmax_point(pointcloud, min_points, max_points, minmax_index_list);
+	for(size_t i = 0; i < descriptors.points.size(); i++){
+		const clustering::ClusterDescriptor &d = descriptors.points[i];
+		if(!all_clusters && !(d.flags & clustering::DESCRIPTOR_HUMAN)) continue;
+		if(d.count == 0) continue;
+		add_bbox(d, bbox_marker);
+		add_minmax_point(d, min_points, max_points);
+	}
+	if(bbox_marker.points.empty()){
+		return;
+	}
+	pub_bbox.publish(bbox_marker);
 
 	sensor_msgs::PointCloud2 min_points_pc2;
 	pcl::toROSMsg(*min_points, min_points_pc2);
@@ -200,25 +152,21 @@ void humanPointsCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
 	pcl::toROSMsg(*max_points, max_points_pc2);
 	max_points_pc2.header = msg->header;
 	pub_max_points.publish(max_points_pc2);
-
-	std_msgs::Header marker_header = msg->header;
-	visualization_msgs::Marker bbox_marker;
-
-	create_bbox_marker(minmax_list, marker_header, bbox_marker);
-	pub_bbox.publish(bbox_marker);
-
 }
 
 int main(int argc, char** argv)
 {
 	ros::init(argc, argv, "bounding_box_visualizer");
 	ros::NodeHandle n;
+	ros::NodeHandle priv_nh("~");
+	priv_nh.param("all_clusters", all_clusters, all_clusters);
+	priv_nh.param("oriented", oriented, oriented);
 
 	pub_min_points = n.advertise<sensor_msgs::PointCloud2>("/bbox/min_points", 1);
 	pub_max_points = n.advertise<sensor_msgs::PointCloud2>("/bbox/max_points", 1);
 	pub_bbox = n.advertise<visualization_msgs::Marker>("/bbox/marker", 1);
 
-	ros::Subscriber sub_human_points = n.subscribe("/human_points", 1, humanPointsCallback);
+	ros::Subscriber sub_descriptors = n.subscribe("/human_points/descriptors", 1, descriptorsCallback);
 	cout<<"Here we go!!"<<endl;
 
 	ros::spin();
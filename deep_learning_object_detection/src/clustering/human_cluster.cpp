@@ -11,12 +11,17 @@
 #include <pcl/ModelCoefficients.h>
 #include <pcl/sample_consensus/method_types.h>
 #include <pcl/sample_consensus/model_types.h>
-#include <pcl/segmentation/sac_segmentation.h>
 #include <pcl/filters/voxel_grid.h>
 #include <pcl/filters/extract_indices.h>
 #include <pcl/kdtree/kdtree.h>
 #include <pcl/segmentation/extract_clusters.h>
 
+#include <infant_utils/parallel_compaction.h>
+#include <deep_learning_object_detection/range_clustering.h>
+#include <deep_learning_object_detection/ground_plane.h>
+#include <deep_learning_object_detection/cluster_view.h>
+#include <deep_learning_object_detection/cluster_descriptor.h>
+
 using namespace std;
 
 // typedef pcl::PointXYZRGB PointType;
@@ -29,142 +34,129 @@ ros::Publisher pub_debug3;
 ros::Publisher pub_debug4;
 ros::Publisher pub_human_points;
 ros::Publisher pub_centroid_cloud;
+ros::Publisher pub_descriptors;
+
+// true : kd-tree EuclideanClusterExtraction, false : range image union-find
+bool use_kdtree = false;
+range_image::RangeClusteringParams cluster_params;
+range_image::RangeClustering range_clustering;
+
+// "ransac" : warm started from the last frame, "heightmap" : seeded by the
+// ground points of the height map for the same scan
+string ground_source = "ransac";
+scan_preprocessing::GroundPlane<PointType> ground_plane;
+sensor_msgs::PointCloud2ConstPtr ground_msg;
 
-float calculate_distance_xy_plane(PointType input_point)
+typedef clustering::ClusterView<PointType> ClusterViewType;
+typedef pcl::PointCloud<clustering::ClusterDescriptor> DescriptorCloud;
+
+clustering::DescriptorParams descriptor_params;
+
+float calculate_distance_xy_plane(const Eigen::Vector4f &point)
 {
-	return sqrt(pow(input_point.x, 2.0) + pow(input_point.y, 2.0));
+	return sqrt(point[0] * point[0] + point[1] * point[1]);
 }
 
-void calculate_centroid(CloudType input_cloud, PointType *centroid_point)
+void calculate_centroid(const ClusterViewType &clusters, const std::vector<int> &indices, PointType *centroid_point)
 {
-	Eigen::Vector4f xyz_centroid(0.0, 0.0, 0.0, 0.0);
-	pcl::compute3DCentroid(input_cloud, xyz_centroid);
+	Eigen::Vector4f xyz_centroid = clusters.centroid(indices);
 	centroid_point->x = xyz_centroid[0];
 	centroid_point->y = xyz_centroid[1];
 	centroid_point->z = xyz_centroid[2];
 }
 
-void coloring_cluster(std::vector<CloudType> &cluster_list)
+// red, green, blue, black, then white
+void cluster_color(size_t i, PointType &p)
 {
-	size_t cluster_list_size = cluster_list.size();
-	for(size_t i = 0; i < cluster_list_size; i++){
-		size_t cluster_cloud_size = cluster_list[i].points.size();
-		// cout<<"i : "<<i<<endl;
-		for(size_t j = 0; j < cluster_cloud_size; j++){
-			if(i == 0){
-				// cout<<"red"<<endl;
-				cluster_list[i].points[j].r = 255;
-				cluster_list[i].points[j].g = 0;
-				cluster_list[i].points[j].b = 0;
-			}
-			else if(i == 1){
-				// cout<<"green"<<endl;
-				cluster_list[i].points[j].r = 0;
-				cluster_list[i].points[j].g = 255;
-				cluster_list[i].points[j].b = 0;
-			}
-			else if(i == 2){
-				// cout<<"bule"<<endl;
-				cluster_list[i].points[j].r = 0;
-				cluster_list[i].points[j].g = 0;
-				cluster_list[i].points[j].b = 255;
-			}
-			else if(i == 3){
-				// cout<<"black"<<endl;
-				cluster_list[i].points[j].r = 0;
-				cluster_list[i].points[j].g = 0;
-				cluster_list[i].points[j].b = 0;
-			}
-			else{
-				// cout<<"white"<<endl;
-				cluster_list[i].points[j].r = 255;
-				cluster_list[i].points[j].g = 255;
-				cluster_list[i].points[j].b = 255;
-			}
-		}
-	}
+	static const uint8_t colors[5][3] = {{255, 0, 0}, {0, 255, 0}, {0, 0, 255}, {0, 0, 0}, {255, 255, 255}};
+	size_t c = i < 4 ? i : 4;
+	p.r = colors[c][0];
+	p.g = colors[c][1];
+	p.b = colors[c][2];
 }
 
-void check_cluster_min_distance(std::vector<CloudType> cluster_list, 
-								CloudType::Ptr output_cloud)
+void coloring_cluster(const ClusterViewType &clusters, CloudType::Ptr output_cloud)
 {
-	size_t cluster_list_size = cluster_list.size();
-	if(cluster_list_size > 0){
-		std::vector<PointType> centroid_list;
-		centroid_list.resize(cluster_list_size);
-		for(size_t i = 0; i < cluster_list_size; i++){
-			PointType centroid_point;
-			calculate_centroid(cluster_list[i], &centroid_point);
-			cout<<"centroid_point : "<<centroid_point<<endl;
-			centroid_list[i] = centroid_point;
+	for(size_t i = 0; i < clusters.size(); i++){
+		size_t first = output_cloud->points.size();
+		clusters.materialize(i, *output_cloud);
+		for(size_t j = first; j < output_cloud->points.size(); j++){
+			cluster_color(i, output_cloud->points[j]);
 		}
-
-		float min_dist = calculate_distance_xy_plane(centroid_list[0]);
-		int min_index = 0;
-		size_t centroid_list_size = centroid_list.size();
-		for(size_t i = 1; i < centroid_list_size; i++){
-			float tmp_dist = calculate_distance_xy_plane(centroid_list[i]);
-			if(tmp_dist < min_dist){
-				min_dist = tmp_dist;
-				min_index = i;
-			}
-		}
-		cout<<"min_index : "<<min_index<<endl;
-		*output_cloud = cluster_list[min_index];
 	}
 }
 
-void check_cluster_normal_vector(CloudType::Ptr single_cluster, 
-								 CloudType::Ptr output_cloud)
+// cluster with the centroid closest to the LiDAR in the xy-plane, -1 if none
+int check_cluster_min_distance(const DescriptorCloud &descriptors)
 {
-	for(size_t i = 0; i < single_cluster->points.size(); i++){
-		// cout<<"single_cluster->points["<<i<<"].normal_x : "<<single_cluster->points[i].normal_x<<endl;
-		// cout<<"single_cluster->points["<<i<<"].normal_y : "<<single_cluster->points[i].normal_y<<endl;
-		// cout<<"single_cluster->points["<<i<<"].normal_z : "<<single_cluster->points[i].normal_z<<endl<<endl;
-		if(single_cluster->points[i].normal_x < 1.0 && single_cluster->points[i].normal_y < 1.0){
-			output_cloud->points.push_back(single_cluster->points[i]);
+	int min_index = -1;
+	float min_dist = 0.0;
+	for(size_t i = 0; i < descriptors.points.size(); i++){
+		const clustering::ClusterDescriptor &d = descriptors.points[i];
+		Eigen::Vector4f centroid(d.x, d.y, d.z, 1.0);
+		cout<<"centroid_point : "<<centroid.head<3>().transpose()<<endl;
+		float tmp_dist = calculate_distance_xy_plane(centroid);
+		if(min_index < 0 || tmp_dist < min_dist){
+			min_dist = tmp_dist;
+			min_index = i;
 		}
 	}
-	// *output_cloud = *single_cluster;
+	cout<<"min_index : "<<min_index<<endl;
+	return min_index;
 }
 
-void cluster(CloudType::Ptr input_cloud, 
-			 CloudType::Ptr multi_cluster,
-			 CloudType::Ptr single_cluster,
-			 CloudType::Ptr output_cloud,
-			 std::vector<pcl::PointIndices> &cluster_indices)
+void check_cluster_normal_vector(const ClusterViewType &clusters,
+								 const std::vector<int> &single_cluster,
+								 std::vector<int> &output_indices)
 {
-	pcl::search::KdTree<PointType>::Ptr tree (new pcl::search::KdTree<PointType>);
-	tree->setInputCloud(input_cloud);
-
-	pcl::EuclideanClusterExtraction<PointType> ec;
-	ec.setClusterTolerance(0.300);
-	ec.setMinClusterSize(10);
-	ec.setMaxClusterSize(25000);
-	ec.setSearchMethod(tree);
-	ec.setInputCloud(input_cloud);
-	ec.extract(cluster_indices);
-
-	std::vector<CloudType> cluster_list;
-	for(std::vector<pcl::PointIndices>::const_iterator it = cluster_indices.begin(); it != cluster_indices.end(); ++it){
-		CloudType::Ptr cluster_cloud (new CloudType);
-		for(std::vector<int>::const_iterator pit = it->indices.begin(); pit != it->indices.end(); ++pit){
-			cluster_cloud->points.push_back(input_cloud->points[*pit]);
-		}
-		cout<<"cluster_cloud->points.size() : "<<cluster_cloud->points.size()<<endl;
-		cluster_list.push_back(*cluster_cloud);
-	}
-	cout<<"cluster_list.size() : "<<cluster_list.size()<<endl;
-		
-	coloring_cluster(cluster_list);
+	infant_utils::compactTo(single_cluster, output_indices, [&](int i){
+		const PointType &p = clusters.point(i);
+		// cout<<"normal : "<<p.normal_x<<" "<<p.normal_y<<" "<<p.normal_z<<endl;
+		return p.normal_x < 1.0 && p.normal_y < 1.0;
+	});
+}
 
-	for(size_t i = 0;i<cluster_list.size();i++){
-		*multi_cluster += cluster_list[i];
+void cluster(CloudType::ConstPtr input_cloud,
+			 ClusterViewType &clusters,
+			 DescriptorCloud &descriptors,
+			 int &single_index,
+			 std::vector<int> &output_indices)
+{
+	clusters.setCloud(input_cloud);
+	std::vector<pcl::PointIndices> &cluster_indices = clusters.clusters();
+	if(use_kdtree){
+		pcl::search::KdTree<PointType>::Ptr tree (new pcl::search::KdTree<PointType>);
+		tree->setInputCloud(input_cloud);
+
+		pcl::EuclideanClusterExtraction<PointType> ec;
+		ec.setClusterTolerance(cluster_params.tolerance);
+		ec.setMinClusterSize(cluster_params.min_size);
+		ec.setMaxClusterSize(cluster_params.max_size);
+		ec.setSearchMethod(tree);
+		ec.setInputCloud(input_cloud);
+		ec.extract(cluster_indices);
+	}
+	else{
+		range_clustering.extract(*input_cloud, cluster_indices);
 	}
-	
-	check_cluster_min_distance(cluster_list, single_cluster);
 
-	check_cluster_normal_vector(single_cluster, output_cloud);
+	for(size_t i = 0; i < clusters.size(); i++){
+		cout<<"cluster_cloud->points.size() : "<<clusters.indices(i).size()<<endl;
+	}
+	cout<<"cluster_list.size() : "<<clusters.size()<<endl;
+
+	output_indices.clear();
+	if(ground_plane.hasPlane()) descriptor_params.ground = ground_plane.plane();
+	clustering::describeClusters(clusters, descriptor_params, descriptors);
+
+	single_index = check_cluster_min_distance(descriptors);
+	if(single_index >= 0){
+		check_cluster_normal_vector(clusters, clusters.indices(single_index), output_indices);
+		// the human box is the one of /human_points, after the normal filter
+		clustering::ClusterDescriptor &human = descriptors.points[single_index];
+		clustering::describeIndices(clusters, output_indices, single_index, descriptor_params, human);
+		human.flags |= clustering::DESCRIPTOR_HUMAN;
+	}
 }
 
 void plane_removal(CloudType::Ptr input_cloud,
@@ -184,20 +176,18 @@ void plane_segmentation(CloudType::Ptr pointcloud,
 						pcl::ModelCoefficients::Ptr coefficients,
 						pcl::PointIndices::Ptr inliers)
 {
-	pcl::SACSegmentation<PointType> seg;
-	seg.setOptimizeCoefficients(true);
-	seg.setModelType(pcl::SACMODEL_PLANE);
-	seg.setMethodType(pcl::SAC_RANSAC);
-	seg.setMaxIterations (1000);
-	seg.setDistanceThreshold(0.1);
-
-	seg.setInputCloud(pointcloud);
-	seg.segment(*inliers, *coefficients);
+	if(ground_source == "heightmap" && ground_msg && pcl_conversions::toPCL(ground_msg->header.stamp) == pointcloud->header.stamp){
+		pcl::PointCloud<pcl::PointXYZ> ground;
+		pcl::fromROSMsg(*ground_msg, ground);
+		ground_plane.fitSeed(ground);
+	}
 
-	if(inliers->indices.size() == 0){
+	scan_preprocessing::PlaneSource source = ground_plane.segment(pointcloud, *inliers, *coefficients);
+	if(source == scan_preprocessing::PLANE_NONE){
 		ROS_ERROR("Could not estimate a planar model for the given dataset.");
 		return;
 	}
+	ROS_DEBUG("ground plane from %s", source == scan_preprocessing::PLANE_RANSAC ? "RANSAC" : "hypothesis");
 
 	// cout<<"Model coefficients : "<<coefficients->values[0]<<"\t"
 								 // <<coefficients->values[1]<<"\t"
@@ -212,6 +202,11 @@ void plane_segmentation(CloudType::Ptr pointcloud,
 	}
 }
 
+void groundCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
+{
+	ground_msg = msg;
+}
+
 void humanPointsCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
 {
 	cout<<"====================================================="<<endl;
@@ -221,22 +216,24 @@ void humanPointsCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
 	
 	pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
 	pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-	CloudType::Ptr removed_points (new CloudType);
 
 	plane_segmentation(pointcloud, coefficients, inliers);
-	plane_removal(pointcloud, removed_points, inliers);
 
-	std::vector<pcl::PointIndices> cluster_indices;
-	CloudType::Ptr multi_cluster (new CloudType);
-	CloudType::Ptr single_cluster (new CloudType);
-	CloudType::Ptr cluster_cloud (new CloudType);
-	// cluster(removed_points, multi_cluster, single_cluster, cluster_cloud, cluster_indices);
-	cluster(pointcloud, multi_cluster, single_cluster, cluster_cloud, cluster_indices);
+	ClusterViewType clusters;
+	DescriptorCloud descriptors;
+	int single_index;
+	std::vector<int> human_indices;
+	cluster(pointcloud, clusters, descriptors, single_index, human_indices);
+
+	sensor_msgs::PointCloud2 descriptors_pc2;
+	pcl::toROSMsg(descriptors, descriptors_pc2);
+	descriptors_pc2.header = msg->header;
+	pub_descriptors.publish(descriptors_pc2);
 
 
 	// calculate human cluster centroid
 	PointType centroid;
-	calculate_centroid(*cluster_cloud, &centroid);
+	calculate_centroid(clusters, human_indices, &centroid);
 	// cout<<"centroid : "<<centroid<<endl;
 	CloudType::Ptr centroid_cloud (new CloudType);
 	centroid_cloud->points.push_back(centroid);
@@ -246,36 +243,63 @@ void humanPointsCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
 	centroid_cloud_pc2.header = msg->header;
 	pub_centroid_cloud.publish(centroid_cloud_pc2);
 
+	// the clouds below are only built for topics with subscribers
 
 	//plane segmentation (plane is segmented red color)
-	sensor_msgs::PointCloud2 debug_pc;
-	pcl::toROSMsg(*pointcloud, debug_pc);
-	debug_pc.header = msg->header;
-	pub_debug.publish(debug_pc);
+	if(pub_debug.getNumSubscribers() > 0){
+		sensor_msgs::PointCloud2 debug_pc;
+		pcl::toROSMsg(*pointcloud, debug_pc);
+		debug_pc.header = msg->header;
+		pub_debug.publish(debug_pc);
+	}
 
 	//plane extracted
-	sensor_msgs::PointCloud2 debug_pc2;
-	pcl::toROSMsg(*removed_points, debug_pc2);
-	debug_pc2.header = msg->header;
-	pub_debug2.publish(debug_pc2);
+	if(pub_debug2.getNumSubscribers() > 0){
+		CloudType::Ptr removed_points (new CloudType);
+		plane_removal(pointcloud, removed_points, inliers);
+		sensor_msgs::PointCloud2 debug_pc2;
+		pcl::toROSMsg(*removed_points, debug_pc2);
+		debug_pc2.header = msg->header;
+		pub_debug2.publish(debug_pc2);
+	}
 
 	//multiple clusters are colored in red, green, bule, black and white
-	sensor_msgs::PointCloud2 debug_pc3;
-	pcl::toROSMsg(*multi_cluster, debug_pc3);
-	debug_pc3.header = msg->header;
-	pub_debug3.publish(debug_pc3);
+	if(pub_debug3.getNumSubscribers() > 0){
+		CloudType::Ptr multi_cluster (new CloudType);
+		coloring_cluster(clusters, multi_cluster);
+		sensor_msgs::PointCloud2 debug_pc3;
+		pcl::toROSMsg(*multi_cluster, debug_pc3);
+		debug_pc3.header = msg->header;
+		pub_debug3.publish(debug_pc3);
+	}
 
 	//single cluster(extracted by distance from LiDAR)
-	sensor_msgs::PointCloud2 debug_pc4;
-	pcl::toROSMsg(*single_cluster, debug_pc4);
-	debug_pc4.header = msg->header;
-	pub_debug4.publish(debug_pc4);
+	if(pub_debug4.getNumSubscribers() > 0){
+		CloudType::Ptr single_cluster (new CloudType);
+		if(single_index >= 0){
+			clusters.materialize(single_index, *single_cluster);
+			for(size_t j = 0; j < single_cluster->points.size(); j++){
+				cluster_color(single_index, single_cluster->points[j]);
+			}
+		}
+		sensor_msgs::PointCloud2 debug_pc4;
+		pcl::toROSMsg(*single_cluster, debug_pc4);
+		debug_pc4.header = msg->header;
+		pub_debug4.publish(debug_pc4);
+	}
 
 	//single cluster(extracted by normal vector) <--- for now, human clustering is completed
-	sensor_msgs::PointCloud2 human_points_pc2;
-	pcl::toROSMsg(*cluster_cloud, human_points_pc2);
-	human_points_pc2.header = msg->header;
-	pub_human_points.publish(human_points_pc2);
+	if(pub_human_points.getNumSubscribers() > 0){
+		CloudType::Ptr cluster_cloud (new CloudType);
+		clusters.materialize(human_indices, *cluster_cloud);
+		for(size_t j = 0; j < cluster_cloud->points.size(); j++){
+			cluster_color(single_index, cluster_cloud->points[j]);
+		}
+		sensor_msgs::PointCloud2 human_points_pc2;
+		pcl::toROSMsg(*cluster_cloud, human_points_pc2);
+		human_points_pc2.header = msg->header;
+		pub_human_points.publish(human_points_pc2);
+	}
 }
 
 
@@ -283,6 +307,28 @@ int main(int argc, char** argv)
 {
 	ros::init(argc, argv, "human_cluster");
 	ros::NodeHandle n;
+	ros::NodeHandle priv_nh("~");
+
+	string sensor;
+	priv_nh.param("use_kdtree", use_kdtree, false);
+	priv_nh.param<string>("sensor", sensor, "HDL-32");
+	if(!range_image::sensorModelFromString(sensor, cluster_params.sensor)){
+		ROS_WARN_STREAM("unknown sensor " << sensor << ", using HDL-32");
+	}
+	priv_nh.param("cluster_tolerance", cluster_params.tolerance, cluster_params.tolerance);
+	priv_nh.param("min_cluster_size", cluster_params.min_size, cluster_params.min_size);
+	priv_nh.param("max_cluster_size", cluster_params.max_size, cluster_params.max_size);
+	priv_nh.param("cluster_min_range", cluster_params.min_range, cluster_params.min_range);
+	range_clustering.setParams(cluster_params);
+
+	scan_preprocessing::GroundPlaneParams plane_params;
+	priv_nh.param("ground_source", ground_source, ground_source);
+	priv_nh.param("plane_distance_threshold", plane_params.distance_threshold, plane_params.distance_threshold);
+	priv_nh.param("plane_max_iterations", plane_params.max_iterations, plane_params.max_iterations);
+	priv_nh.param("plane_min_inlier_ratio", plane_params.min_inlier_ratio, plane_params.min_inlier_ratio);
+	priv_nh.param("plane_max_tilt_deg", plane_params.max_tilt_deg, plane_params.max_tilt_deg);
+	ground_plane.setParams(plane_params);
+	priv_nh.param("height_bin", descriptor_params.height_bin, descriptor_params.height_bin);
 
 	pub_debug = n.advertise<sensor_msgs::PointCloud2>("/human_points/debug", 1);
 	pub_debug2 = n.advertise<sensor_msgs::PointCloud2>("/human_points/debug2", 1);
@@ -290,8 +336,13 @@ int main(int argc, char** argv)
 	pub_debug4 = n.advertise<sensor_msgs::PointCloud2>("/human_points/debug4", 1);
 	pub_human_points = n.advertise<sensor_msgs::PointCloud2>("/human_points", 1);
 	pub_centroid_cloud = n.advertise<sensor_msgs::PointCloud2>("/human_points/centroid", 1);
+	pub_descriptors = n.advertise<sensor_msgs::PointCloud2>("/human_points/descriptors", 1);
 
 	ros::Subscriber sub_humanpoints = n.subscribe("/human_points/candidate", 1, humanPointsCallback);
+	ros::Subscriber sub_ground;
+	if(ground_source == "heightmap"){
+		sub_ground = n.subscribe("velodyne_clear", 1, groundCallback);
+	}
 
 	cout<<"Here we go!!!"<<endl;
 
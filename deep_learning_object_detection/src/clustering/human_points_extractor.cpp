@@ -6,11 +6,15 @@
 #include <sensor_msgs/image_encodings.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/CameraInfo.h>
+#include <nav_msgs/Odometry.h>
 // #include <camera_info_manager/camera_info_manager.h>
 // #include <tf/tf.h>
+#include <tf/transform_listener.h>
 
 #include "opencv2/opencv.hpp"
 
+#include <algorithm>
+
 // #include <pcl_ros/point_cloud.h>
 
 #include <pcl/point_cloud.h>
@@ -18,7 +22,11 @@
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl/io/pcd_io.h>
 #include <pcl/common/eigen.h>
-#include <pcl/common/transforms.h>
+
+#include <infant_utils/batch_projection.h>
+#include <infant_utils/stamped_buffer.h>
+
+#include <deep_learning_object_detection/candidate_point.h>
 
 using namespace std;
 using namespace cv;
@@ -27,15 +35,21 @@ using namespace pcl;
 // typedef PointXYZRGB PointType;
 typedef PointXYZRGBNormal PointType;
 typedef PointCloud<PointType> CloudType;
+typedef PointCloud<clustering::CandidatePoint> CandidateCloud;
 
 string CAMERA_INFO_TOPIC;
 string VELODYNE_COLOR_TOPIC;
 string HUMAN_CANDIDATE_TOPIC;
 string IMAGE_HEADER_TOPIC;
 string BBOX_TOPIC;
+string ODOMETRY_TOPIC;
 vector<float> DoF;
 
-cv::Mat projection_matrix;
+infant_utils::BatchProjection projection;
+// P of the camera info
+Eigen::Matrix<float, 3, 4> camera_matrix = Eigen::Matrix<float, 3, 4>::Zero();
+// velodyne -> camera : the axis swap (x := x, y := -z, z := y) followed by DoF
+Eigen::Affine3f velodyne_to_camera = Eigen::Affine3f::Identity();
 int image_width;
 int image_height;
 
@@ -44,62 +58,217 @@ ros::Publisher pub_human_candidate;
 std_msgs::Header img_header;
 
 vector<int> bbox_array;
-int expand_pixel = 150;
+// margin around the boxes, only needed without the stamp matching
+int expand_pixel = 0;
 
 bool bbox_flag = false;
+// stamp of the image the pending boxes were detected in
+ros::Time detection_stamp;
+
+/*
+ * The detectors publish the image header before inference and the boxes
+ * after it, so the boxes belong to the last header. They are matched to
+ * the buffered scan nearest to that stamp instead of the newest scan.
+ */
+struct Scan
+{
+	std_msgs::Header header;
+	CloudType::Ptr cloud;
+};
+
+infant_utils::StampedBuffer<Scan> scan_history;
+// a scan further than this from the image is not used [s]
+double max_stamp_diff = 0.05;
+
+// /lcl poses to move the scan to where the camera was at the image stamp
+bool use_odometry = false;
+infant_utils::StampedBuffer<geometry_msgs::Pose> pose_history;
+/*
+ * /lcl is the pose of the base, the scan is in the velodyne frame, so the
+ * base motion is conjugated with the mounting (velodyne pose in the base
+ * frame). It is looked up once through tf; base_frame empty : the
+ * child_frame_id of the odometry.
+ */
+tf::TransformListener *listener;
+string base_frame;
+bool has_mounting = false;
+Eigen::Affine3f base_to_velodyne = Eigen::Affine3f::Identity();
+
+/*
+ * Index buffer of the projected cloud: the nearest point of every hit
+ * pixel, stored by image row (CSR) and sorted by column inside a row.
+ * Built with one projection per frame; a box then only visits its rows.
+ */
+struct PixelHit
+{
+	int u;
+	float depth;
+	int index;
+};
+
+vector<PixelHit> pixel_hits;
+// hits of row v are pixel_hits[row_start[v], row_start[v + 1])
+vector<int> row_start;
+// hit already gathered by an earlier box of the frame
+vector<char> hit_taken;
+
+bool nearer_hit(const PixelHit &a, const PixelHit &b)
+{
+	return a.u < b.u || (a.u == b.u && a.depth < b.depth);
+}
 
-cv::Point cv_project(PointType input, cv::Mat matrix){
-    cv::Mat pt_3D(4, 1, CV_32FC1);
-
-    pt_3D.at<float>(0) = input.x;
-    pt_3D.at<float>(1) = input.y;
-    pt_3D.at<float>(2) = input.z;
-    pt_3D.at<float>(3) = 1.0f; // is homogenious coords. the point's 4. coord is 1
-
-    cv::Mat pt_2D = matrix * pt_3D;
-
-    float w = pt_2D.at<float>(2);
-    float x = pt_2D.at<float>(0) / w;
-    float y = pt_2D.at<float>(1) / w;
-
-    return cv::Point2f(x, y);
+// inside one of the (expanded) boxes
+bool in_boxes(int u, int v)
+{
+	for(size_t k = 0; k + 3 < bbox_array.size(); k += 4){
+		const int *box = &bbox_array[k];
+		if(u >= box[0] && u < box[2] && v >= box[1] && v < box[3]){
+			return true;
+		}
+	}
+	return false;
 }
 
-void project(cv::Mat matrix, Rect frame, CloudType::Ptr input, CloudType::Ptr output, vector<int>* index){
-	size_t input_size = input->points.size();
-	for (size_t i = 0; i < input_size; i++){
-		
-		// behind the camera
-		if (input->points[i].z < 0.0){
+// the scan is projected straight from the velodyne frame with matrix = P * transform
+void build_index_buffer(const CloudType &scan, const Eigen::Matrix<float, 3, 4> &matrix)
+{
+	projection.setMatrix(matrix);
+	projection.project(scan);
+	size_t input_size = projection.size();
+	vector<PixelHit> projected;
+	vector<int> projected_row;
+	projected.reserve(projection.visibleCount());
+	projected_row.reserve(projection.visibleCount());
+	row_start.assign(image_height + 1, 0);
+	for(size_t i = 0; i < input_size; i++){
+		if(!projection.visible(i) || !in_boxes(projection.col(i), projection.row(i))){
 			continue;
 		}
+		PixelHit hit = {projection.col(i), projection.depth(i), (int)i};
+		projected.push_back(hit);
+		projected_row.push_back(projection.row(i));
+		row_start[projection.row(i) + 1]++;
+	}
 
-		// cout<<"input->points["<<i<<"] : "<<input->points[i]<<endl;
+	// counting sort by row
+	for(int v = 0; v < image_height; v++){
+		row_start[v + 1] += row_start[v];
+	}
+	pixel_hits.resize(projected.size());
+	vector<int> cursor(row_start.begin(), row_start.end() - 1);
+	for(size_t k = 0; k < projected.size(); k++){
+		pixel_hits[cursor[projected_row[k]]++] = projected[k];
+	}
 
-		cv::Point xy = cv_project(input->points[i], projection_matrix);
+	// sort every row by column and keep the nearest point of each pixel
+	int kept = 0;
+	for(int v = 0; v < image_height; v++){
+		int begin = row_start[v], end = row_start[v + 1];
+		sort(pixel_hits.begin() + begin, pixel_hits.begin() + end, nearer_hit);
+		row_start[v] = kept;
+		for(int k = begin; k < end; k++){
+			if(k > begin && pixel_hits[k].u == pixel_hits[k - 1].u){
+				continue;
+			}
+			pixel_hits[kept++] = pixel_hits[k];
+		}
+	}
+	row_start[image_height] = kept;
+	pixel_hits.resize(kept);
+	hit_taken.assign(kept, 0);
+}
 
-		if (xy.inside(frame)){
-			if (output != NULL){
-				output->points.push_back(input->points[i]);
-				index->push_back(i);
+// points of the pixels inside [x1, x2) x [y1, y2), labelled with the box index;
+// a point inside overlapping boxes only goes to the first of them
+void gather_box(const int *box, uint32_t label, const CloudType &source, CandidateCloud &output)
+{
+	int x1 = max(box[0], 0), y1 = max(box[1], 0);
+	int x2 = min(box[2], image_width), y2 = min(box[3], image_height);
+	PixelHit first = {x1, -1.0f, 0};
+	for(int v = y1; v < y2; v++){
+		vector<PixelHit>::const_iterator it = lower_bound(pixel_hits.begin() + row_start[v],
+				pixel_hits.begin() + row_start[v + 1], first, nearer_hit);
+		vector<PixelHit>::const_iterator end = pixel_hits.begin() + row_start[v + 1];
+		for(; it != end && it->u < x2; ++it){
+			char &taken = hit_taken[it - pixel_hits.begin()];
+			if(taken){
+				continue;
 			}
+			taken = 1;
+			clustering::CandidatePoint p;
+			clustering::toCandidate(source.points[it->index], label, p);
+			output.points.push_back(p);
 		}
 	}
 }
 
-void transform(CloudType::Ptr input, CloudType::Ptr output, float x, float y, float z, float roll, float pitch, float yaw)
+void update_transform(const vector<float> &dof)
 {
-	Eigen::Affine3f transform_matrix = getTransformation(x, y, z, roll, pitch, yaw);
+	Eigen::Affine3f axis = getTransformation(0, 0, 0, M_PI/2, -M_PI/2, 0);
+	Eigen::Affine3f extrinsic = getTransformation(dof[0], dof[1], dof[2], dof[3], dof[4], dof[5]);
+	velodyne_to_camera = extrinsic * axis;
+}
 
-	transformPointCloud(*input, *output, transform_matrix);
+Eigen::Affine3f to_affine(const geometry_msgs::Pose &pose)
+{
+	Eigen::Quaternionf q(pose.orientation.w, pose.orientation.x, pose.orientation.y, pose.orientation.z);
+	Eigen::Translation3f t(pose.position.x, pose.position.y, pose.position.z);
+	return t * q.normalized();
+}
+
+bool pose_at(const ros::Time &stamp, Eigen::Affine3f &pose)
+{
+	size_t lower, upper;
+	double ratio;
+	if(!pose_history.bracket(stamp, lower, upper, ratio)){
+		return false;
+	}
+	float r = ratio;
+	Eigen::Affine3f a = to_affine(pose_history.value(lower));
+	Eigen::Affine3f b = to_affine(pose_history.value(upper));
+	Eigen::Quaternionf q = Eigen::Quaternionf(a.rotation()).slerp(r, Eigen::Quaternionf(b.rotation()));
+	Eigen::Vector3f t = (1.0f - r) * a.translation() + r * b.translation();
+	pose = Eigen::Translation3f(t) * q;
+	return true;
+}
+
+bool lookup_mounting(const string &velodyne_frame)
+{
+	if(has_mounting){
+		return true;
+	}
+	if(base_frame.empty()){
+		return false;
+	}
+	tf::StampedTransform transform;
+	try{
+		listener->lookupTransform(base_frame, velodyne_frame, ros::Time(0), transform);
+	}
+	catch(tf::TransformException &ex){
+		ROS_WARN_THROTTLE(5.0, "human_points_extractor : %s", ex.what());
+		return false;
+	}
+	tf::Quaternion q = transform.getRotation();
+	tf::Vector3 t = transform.getOrigin();
+	base_to_velodyne = Eigen::Translation3f(t.x(), t.y(), t.z())
+		* Eigen::Quaternionf(q.w(), q.x(), q.y(), q.z()).normalized();
+	has_mounting = true;
+	return true;
 }
 
-void transform_DoF(CloudType::Ptr input, CloudType::Ptr output, vector<float> dof)
+// motion of the sensor from the scan stamp to the image stamp, in the sensor frame
+bool ego_motion(const std_msgs::Header &scan_header, const ros::Time &image_stamp, Eigen::Affine3f &motion)
 {
-	transform(input, output, dof[0], dof[1], dof[2], dof[3], dof[4], dof[5]);
+	Eigen::Affine3f scan_pose, image_pose;
+	if(!lookup_mounting(scan_header.frame_id)
+			|| !pose_at(scan_header.stamp, scan_pose) || !pose_at(image_stamp, image_pose)){
+		return false;
+	}
+	motion = base_to_velodyne.inverse() * image_pose.inverse() * scan_pose * base_to_velodyne;
+	return true;
 }
 
-void expand_bbox(vector<int> &input)
+void expand_bbox(int *input)
 {
 	if(input[0]	> (0 + expand_pixel)){
 		input[0] -= expand_pixel;
@@ -132,13 +301,74 @@ void cameraInfoCallback(const sensor_msgs::CameraInfoConstPtr& msg)
 		p[i] = msg->P[i];
 		// cout<<"p["<<i<<"] : "<<p[i]<<endl;
 	}
-	cv::Mat(3, 4, CV_32FC1, p).copyTo(projection_matrix);
-	// cout<<"projection_matrix : "<<projection_matrix<<endl;
+	camera_matrix = Eigen::Map<Eigen::Matrix<float, 3, 4, Eigen::RowMajor> >(p);
+	projection.setFrame(image_width, image_height);
+}
+
+void extract(const Scan &scan)
+{
+	// every transform is folded into the projection, no cloud is transformed
+	Eigen::Affine3f to_camera = velodyne_to_camera;
+	Eigen::Affine3f motion;
+	if(use_odometry){
+		if(ego_motion(scan.header, detection_stamp, motion)){
+			to_camera = to_camera * motion;
+		}
+		else{
+			ROS_WARN_THROTTLE(5.0, "human_points_extractor : no odometry around the image stamp");
+		}
+	}
+
+	size_t num_box = bbox_array.size() / 4;
+	for(size_t i = 0; i < num_box; i++){
+		int *box = &bbox_array[4 * i];
+		cout<<"box "<<i<<" : "<<box[0]<<" "<<box[1]<<" "<<box[2]<<" "<<box[3]<<endl;
+		expand_bbox(box);
+	}
+
+	// one projection for all the boxes, only hits inside a box are kept
+	build_index_buffer(*scan.cloud, camera_matrix * to_camera.matrix());
+
+	// the points are taken from the buffered scan, in the velodyne frame
+	CandidateCloud human_points_candidate;
+	for(size_t i = 0; i < num_box; i++){
+		gather_box(&bbox_array[4 * i], i, *scan.cloud, human_points_candidate);
+	}
+	human_points_candidate.width = human_points_candidate.points.size();
+	human_points_candidate.height = 1;
+	cout<<"human_points_candidate.points.size() : "<<human_points_candidate.points.size()<<endl;
+
+	sensor_msgs::PointCloud2 human_points_candidate_pc2;
+	toROSMsg(human_points_candidate, human_points_candidate_pc2);
+	human_points_candidate_pc2.header = scan.header;
+	pub_human_candidate.publish(human_points_candidate_pc2);
+}
+
+// tries the pending boxes against the history, they wait for a newer scan if needed
+void extract_pending()
+{
+	int k = scan_history.nearest(detection_stamp);
+	if(k < 0){
+		return;
+	}
+	double diff = (scan_history.stamp(k) - detection_stamp).toSec();
+	if(fabs(diff) > max_stamp_diff){
+		if(diff < 0.0 && k == (int)scan_history.size() - 1){
+			return;
+		}
+		ROS_WARN("human_points_extractor : no scan within %.3f [s] of the image", max_stamp_diff);
+		bbox_flag = false;
+		return;
+	}
+	ROS_DEBUG("human_points_extractor : stamp diff %.3f [s]", diff);
+	bbox_flag = false;
+	extract(scan_history.value(k));
 }
 
 void bboxCallback(const std_msgs::Int32MultiArrayConstPtr& msg)
 {
 	bbox_flag =true;
+	detection_stamp = img_header.stamp;
 
 	size_t msg_size = msg->data.size();
 	// cout<<"msg_size : "<<msg_size<<endl;
@@ -147,43 +377,31 @@ void bboxCallback(const std_msgs::Int32MultiArrayConstPtr& msg)
 		bbox_array.push_back(2 * msg->data[i]);
 		// cout<<"bbox_array["<<i<<"] : "<<bbox_array[i]<<endl;
 	}
+
+	extract_pending();
 }
 
 void pointCloudCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
 {
-	CloudType::Ptr pcl_pc (new CloudType);
-	fromROSMsg(*msg, *pcl_pc);
+	Scan scan;
+	scan.header = msg->header;
+	scan.cloud.reset(new CloudType);
+	fromROSMsg(*msg, *scan.cloud);
+	scan_history.push(msg->header.stamp, scan);
 	
-	// cout<<"pcl_pc->points.size() : "<<pcl_pc->points.size()<<endl;
+	// cout<<"scan.cloud->points.size() : "<<scan.cloud->points.size()<<endl;
 
 	if(bbox_flag){
-		bbox_flag = false;
-		CloudType::Ptr pointcloud (new CloudType);
-		transform(pcl_pc, pointcloud, 0, 0, 0, M_PI/2, -M_PI/2, 0);
-		CloudType::Ptr transformed (new CloudType);
-		transform_DoF(pointcloud, transformed, DoF);
-		
-		CloudType::Ptr visible_points (new CloudType);
-		vector<int> index;
-		// project(projection_matrix, Rect(0, 0, 1920, 1080), transformed, visible_points, &index);
-		cout<<"bbox_array[0] : "<<bbox_array[0]<<"\tbbox_array[1] : "<<bbox_array[1]<<"\tbbox_array[2] : "<<bbox_array[2]<<"\tbbox_array[3] : "<<bbox_array[3]<<endl;
-		expand_bbox(bbox_array);
-		cout<<"bbox_array[0](after) : "<<bbox_array[0]<<"\tbbox_array[1](after) : "<<bbox_array[1]<<"\tbbox_array[2](after) : "<<bbox_array[2]<<"\tbbox_array[3](after) : "<<bbox_array[3]<<endl;
-		project(projection_matrix, Rect(bbox_array[0], bbox_array[1], bbox_array[2] - bbox_array[0], bbox_array[3] - bbox_array[1]), transformed, visible_points, &index);
-		
-		// cout<<"visible_points->points.size() : "<<visible_points->points.size()<<endl;
-
-		CloudType::Ptr human_points_candidate (new CloudType);
-		transform(visible_points, human_points_candidate, 0, 0, 0, -M_PI/2, 0, -M_PI/2);
-		cout<<"human_points_candidate->points.size() : "<<human_points_candidate->points.size()<<endl;
-
-		sensor_msgs::PointCloud2 human_points_candidate_pc2;
-		toROSMsg(*human_points_candidate, human_points_candidate_pc2);
-		human_points_candidate_pc2.header = msg->header;
-		pub_human_candidate.publish(human_points_candidate_pc2);
+		extract_pending();
+	}
+}
+
+void lclCallback(const nav_msgs::OdometryConstPtr& msg)
+{
+	pose_history.push(msg->header.stamp, msg->pose.pose);
+	if(base_frame.empty()){
+		base_frame = msg->child_frame_id;
 	}
-	
-	
 }
 
 int main(int argc, char** argv)
@@ -196,6 +414,22 @@ int main(int argc, char** argv)
 	n.getParam("/human_extract/image_header_topic", IMAGE_HEADER_TOPIC);
 	n.getParam("/human_extract/bounding_box_topic", BBOX_TOPIC);
 	n.getParam("/human_extract/6DoF", DoF);
+	if(DoF.size() != 6){
+		ROS_ERROR("human_points_extractor : 6DoF needs 6 values, got %d", (int)DoF.size());
+		return -1;
+	}
+	update_transform(DoF);
+
+	int history_size = 20;
+	n.param("/human_extract/history_size", history_size, history_size);
+	n.param("/human_extract/max_stamp_diff", max_stamp_diff, max_stamp_diff);
+	n.param("/human_extract/expand_pixel", expand_pixel, expand_pixel);
+	n.param("/human_extract/use_odometry", use_odometry, use_odometry);
+	n.param<string>("/human_extract/odometry_topic", ODOMETRY_TOPIC, "/lcl");
+	n.param<string>("/human_extract/base_frame", base_frame, "");
+	scan_history.setCapacity(history_size);
+	// /lcl runs faster than the velodyne
+	pose_history.setCapacity(5 * history_size);
 
 
 	pub_human_candidate = n.advertise<sensor_msgs::PointCloud2>(HUMAN_CANDIDATE_TOPIC, 1);
@@ -206,6 +440,14 @@ int main(int argc, char** argv)
 	ros::Subscriber sub_header = n.subscribe(IMAGE_HEADER_TOPIC, 1, imageHeaderCallback);
 	ros::Subscriber sub_bbox = n.subscribe(BBOX_TOPIC, 1, bboxCallback);
 
+	tf::TransformListener tf_listener;
+	listener = &tf_listener;
+
+	ros::Subscriber sub_lcl;
+	if(use_odometry){
+		sub_lcl = n.subscribe(ODOMETRY_TOPIC, 10, lclCallback);
+	}
+
 	ros::spin();
 
 
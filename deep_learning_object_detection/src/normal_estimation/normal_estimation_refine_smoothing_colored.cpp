@@ -14,7 +14,7 @@
 #include <pcl_conversions/pcl_conversions.h>
 
 #include <Eigen/Core>
-#include <Eigen/SVD>
+#include <Eigen/Eigenvalues>
 
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud.h>
@@ -25,12 +25,9 @@
 #include <velodyne_msgs/VelodyneScan.h>
 #include <omp.h>
 
-//#define HNN 5
-//#define HNN 7
-#define VNN 1
-#define VN 32
-//#define THRESH_D 0.05 // not bekizyou
-#define THRESH_D 0.2
+#include <deep_learning_object_detection/range_image.h>
+#include <deep_learning_object_detection/integral_moments.h>
+#include <infant_utils/parallel_compaction.h>
 
 using namespace std;
 using namespace Eigen;
@@ -52,6 +49,8 @@ visualization_msgs::Marker mk;
 // CloudPtr pc (new Cloud);
 CloudNPtr pc (new CloudN);
 // CloudSPtr pc (new CloudS);
+range_image::RangeImage img;
+range_image::IntegralMoments moments;
 ros::Publisher pub;
 ros::Publisher pub_2;
 ros::Publisher pub_3;
@@ -59,11 +58,20 @@ ros::Publisher pub_4;
 ros::Publisher pub_s;
 ros::Publisher pub_mk;
 
-size_t skip = 5;
+size_t skip = 1;
 int HNN = 7;
+int VNN = 1;
+string SENSOR = "HDL-32";
 float VR = 0.839 * 0.60;
 float MIN_RANGE = 0.2f;
 float MAX_RANGE = 120.0f;
+//relative range jump that splits a ring window (0.05 : not bekizyou)
+float THRESH_D = 0.2f;
+//0 : gather every neighbour (the original rule, default)
+//1 : window sums from integral images; the window is shrunk per side to the
+//    first THRESH_D / vector_vertical discontinuity instead of testing each
+//    neighbour against vector_horizon, so normals and curvature differ at edges
+int INTEGRAL = 0;
 
 float DENS;
 float CURV;
@@ -91,6 +99,10 @@ void getParam(ros::NodeHandle &n, string param, T &val){
 
 bool getParams(ros::NodeHandle &n){
 	getParam(n, "HNN", HNN);
+	if(n.hasParam("VNN")) getParam(n, "VNN", VNN);
+	if(n.hasParam("SENSOR")) getParam(n, "SENSOR", SENSOR);
+	if(n.hasParam("THRESH_D")) getParam(n, "THRESH_D", THRESH_D);
+	if(n.hasParam("INTEGRAL")) getParam(n, "INTEGRAL", INTEGRAL);
 	getParam(n, "MIN_RANGE", MIN_RANGE);
 	getParam(n, "MAX_RANGE", MAX_RANGE);
 	getParam(n, "skip", skip);
@@ -100,46 +112,31 @@ bool getParams(ros::NodeHandle &n){
 	getParam(n, "DENS", DENS);
 	getParam(n, "CURV", CURV);
 	getParam(n, "DISP", DISP);
+
+	range_image::SensorModel model;
+	if(!range_image::sensorModelFromString(SENSOR, model)){
+		ROS_ERROR_STREAM("unknown sensor " << SENSOR);
+		return false;
+	}
+	img.setSensorModel(model);
 	return true;
 }
 
 void rm_zero(CloudN &pc){
-	CloudN tmp;
-	tmp.points.clear();
-	for(size_t i=0;i<pc.points.size();i++){
-		float x = pc.points[i].x;
-		float y = pc.points[i].y;
-		float z = pc.points[i].z;
-		// float c = pc.points[i].curvature;
-		float d = sqrt(x*x + y*y + z*z);
-
-		if((d < MAX_RANGE) && (d  > MIN_RANGE)){
-			tmp.points.push_back(pc.points[i]);
-		}
-	}
-	pc.points.clear();
-	pc = tmp;
+	infant_utils::compact(pc, [](const PointN &p){
+		// float c = p.curvature;
+		float d = sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
+		return (d < MAX_RANGE) && (d  > MIN_RANGE);
+	});
 }
 
 void rm_zero_nd(CloudN &pc){
-	CloudN tmp;
-	tmp.points.clear();
-	for(size_t i=0;i<pc.points.size();i++){
-		float x = pc.points[i].x;
-		float y = pc.points[i].y;
-		float z = pc.points[i].z;
-		float c = pc.points[i].curvature;
-		float d = sqrt(x*x + y*y + z*z);
-
-		//if((d < MAX_RANGE) && (d  > MIN_RANGE) && (c < CURV)){
-		if( (d > 0.1) && (c < 0.18) ){
-			tmp.points.push_back(pc.points[i]);
-		}
-	}
 	//cout << pc.points.size() ;
-	pc.points.clear();
-	pc = tmp;
-
+	infant_utils::compact(pc, [](const PointN &p){
+		float d = sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
+		//if((d < MAX_RANGE) && (d  > MIN_RANGE) && (p.curvature < CURV)){
+		return (d > 0.1) && (p.curvature < 0.18);
+	});
 	//cout << " -> " << pc.points.size() << endl ;
 }
 
@@ -152,103 +149,6 @@ void init_zero(CloudN &in){
 	}
 }
 
-size_t itr(const size_t &num)
-{
-	size_t tmp;
-	size_t tmp_1 = num % VN;
-
-	switch (tmp_1){
-		case 0: tmp = 0; break;
-		case 1: tmp = 2; break;
-		case 2: tmp = 4; break;
-		case 3: tmp = 6; break;
-		case 4: tmp = 8; break;
-		case 5: tmp =  10; break;
-		case 6: tmp =  12; break;
-		case 7: tmp =  14; break;
-		case 8: tmp =  16; break;
-		case 9: tmp =  18; break;
-		case 10: tmp =  20; break;
-		case 11: tmp =  22; break;
-		case 12: tmp =  24; break;
-		case 13: tmp =  26; break;
-		case 14: tmp =  28; break;
-		case 15: tmp =  30; break;
-		case 16: tmp =  1; break;
-		case 17: tmp =  3; break;
-		case 18: tmp =  5; break;
-		case 19: tmp =  7; break;
-		case 20: tmp =  9; break;
-		case 21: tmp =  11; break;
-		case 22: tmp =  13; break;
-		case 23: tmp =  15; break;
-		case 24: tmp =  17; break;
-		case 25: tmp =  19; break;
-		case 26: tmp =  21; break;
-		case 27: tmp =  23; break;
-		case 28: tmp =  25; break;
-		case 29: tmp =  27; break;
-		case 30: tmp =  29; break;
-		case 31: tmp =  31; break;
-	}
-	return num - tmp_1 + tmp;
-}
-
-inline size_t itr_inv(const size_t &num)
-{
-	//size_t tmp = num%32;
-	//return (tmp/16)*(2*(tmp-16)+1) + (1-(tmp/16))*(2*tmp) + 32*(num/32);
-
-	size_t tmp;
-	size_t tmp_1 = num % VN;
-	switch (tmp_1){
-		case 0: tmp = 0; break;
-		case 1: tmp = 16; break;
-		case 2: tmp = 1; break;
-		case 3: tmp = 17; break;
-		case 4: tmp = 2; break;
-		case 5: tmp =  18; break;
-		case 6: tmp =  3; break;
-		case 7: tmp =  19; break;
-		case 8: tmp =  4; break;
-		case 9: tmp =  20; break;
-		case 10: tmp =  5; break;
-		case 11: tmp =  21; break;
-		case 12: tmp =  6; break;
-		case 13: tmp =  22; break;
-		case 14: tmp =  7; break;
-		case 15: tmp =  23; break;
-		case 16: tmp =  8; break;
-		case 17: tmp =  24; break;
-		case 18: tmp =  9; break;
-		case 19: tmp =  25; break;
-		case 20: tmp =  10; break;
-		case 21: tmp =  26; break;
-		case 22: tmp =  11; break;
-		case 23: tmp =  27; break;
-		case 24: tmp =  12; break;
-		case 25: tmp =  28; break;
-		case 26: tmp =  13; break;
-		case 27: tmp =  29; break;
-		case 28: tmp =  14; break;
-		case 29: tmp =  30; break;
-		case 30: tmp =  15; break;
-		case 31: tmp =  31; break;
-	}
-	return num - tmp_1 + tmp;
-	//	return VN*(num/VN) + tmp;
-}
-
-
-inline bool jud(const int &num){
-	bool b1 = (num >= 0);
-	bool b2 = (num < (int)pc->points.size());
-	if(b1&&b2)
-		return true;
-	else
-		return false;
-}
-
 inline bool is_valid(float n){
 	float a = fabs(n);
 	if((a>MIN_RANGE)&&(a<MAX_RANGE))
@@ -338,6 +238,106 @@ void disp(const CloudN &pc)
 	pub_mk.publish( mk );
 }
 
+//depth discontinuity between two neighbours on the same ring (linear in the range)
+inline bool h_edge(int i, int j){
+	float ri = img.range(i);
+	float rj = img.range(j);
+	if(!is_valid(ri) || !is_valid(rj)) return false;
+	return fabs(ri - rj) > THRESH_D * min(ri, rj);
+}
+
+//same rule as the per-neighbour vertical check below
+inline bool v_edge(int i, int j){
+	float ri = img.range(i);
+	float rj = img.range(j);
+	if(!is_valid(ri) || !is_valid(rj)) return false;
+	Vector3f d(img.x(j) - img.x(i), img.y(j) - img.y(i), img.z(j) - img.z(i));
+	return !(d.norm() < vector_vertical*0.0216*pow(min(ri, rj),1.8967));
+}
+
+inline bool valid_pixel(int i){
+	return is_valid(img.range(i));
+}
+
+//centroid and scatter of the edge-free window around (ring, col) from the integral images
+unsigned int window_moments(int ring, int col, Vector3f &cent, Matrix3f &cov){
+	int r0, r1, c0, c1;
+	moments.edgeFreeWindow(ring, col, HNN, VNN, r0, r1, c0, c1);
+	range_image::Moments m;
+	moments.window(r0, r1, c0, c1, m);
+	if(m.n < 0.5) return 0;
+	m.centroidAndScatter(cent, cov);
+	return (unsigned int)(m.n + 0.5);
+}
+
+//exact per-neighbour gathering (INTEGRAL = 0)
+unsigned int neighbour_moments(int ring, int col, const Vector3f &p_q, Vector3f &cent, Matrix3f &cov){
+	int rings = img.rings();
+	int cols = img.cols();
+	float tmp_d = p_q.norm();
+
+	//moments of the neighbours about p_q. fixed size, so every thread keeps them on its own stack.
+	Vector3f sum(Vector3f::Zero());
+	Matrix3f sum_sq(Matrix3f::Zero());
+	unsigned int cnt = 0;
+
+	for(int j=-VNN;j<=VNN;j++){
+		//本点と垂点ベクトル
+		Vector3f v_v;
+		Vector3f p_v;
+		int ring_v = ring + j;
+		if(ring_v < 0 || ring_v >= rings) continue;
+		int v_idx = img.at(ring_v, col);
+		p_v <<
+			img.x(v_idx),
+			img.y(v_idx),
+			img.z(v_idx);
+		//v_v : vector_vertical
+		v_v = p_v - p_q;
+
+		float norm_vv = v_v.norm();
+		//if(! (norm_vv < 0.1*pow(tmp_d,1.8)) ) continue;
+		if(! (norm_vv < vector_vertical*0.0216*pow(tmp_d,1.8967)) ) continue;
+		//if(! (norm_vv < 3.0*0.0216*pow(tmp_d,1.8)) ) continue;
+
+		for(int k=-HNN;k<=HNN;k++){
+
+			int col_h = col + k;
+			if(col_h < 0 || col_h >= cols) continue;
+			int num_tmp = img.at(ring_v, col_h);
+			Vector3f p_h;
+			Vector3f v_h;
+
+			//p_h : horizontal point
+			p_h <<
+				img.x(num_tmp),
+				img.y(num_tmp),
+				img.z(num_tmp);
+
+			if(!is_valid(img.range(num_tmp)))continue;
+			//v_h : horizontal vector
+			v_h << p_h - p_v;
+
+			float norm_vh = v_h.norm();
+			//if(( norm_vh < 0.5 ) && ( fabs((int)(i%VN)-(int)((i+j+32*k)%VN)) ) <= VNN ){		//2013.11.10変更後
+			//ring wrap-around is excluded by the ring_v bounds above
+			if( norm_vh < vector_horizon*p_q.norm() ){		//2013.11.10変更後
+				//relative to p_q so that far points don't lose precision in the squares
+				Vector3f d = p_h - p_q;
+				sum += d;
+				sum_sq += d * d.transpose();
+				cnt ++;
+			}
+		}
+	}
+	if(cnt == 0) return 0;
+
+	Vector3f mean = sum / (float)cnt;
+	cent = p_q + mean;
+	cov = sum_sq - (float)cnt * mean * mean.transpose();
+	return cnt;
+}
+
 
 void pc_callback(sensor_msgs::PointCloud2::Ptr msg)
 {
@@ -347,9 +347,12 @@ void pc_callback(sensor_msgs::PointCloud2::Ptr msg)
 	CloudN pcl_pc_nd;
 	CloudN pcl_pc_final;
 	pcl::fromROSMsg(*msg, *pc);
+	if(!img.build(*msg)) return;
+	if(INTEGRAL) moments.compute(img, valid_pixel, h_edge, v_edge);
 
-
-	size_t i_end = pc->points.size() * VR;
+	int rings = img.rings();
+	size_t i_end = img.size() * VR;
+	if(i_end > img.size()) i_end = img.size();
 
 	//	pcl_pc_c->points.resize(i_end);
 	pcl_pc_n.points.resize(i_end / skip + 1);
@@ -361,100 +364,58 @@ void pc_callback(sensor_msgs::PointCloud2::Ptr msg)
 #pragma omp parallel for
 	for(size_t i=0;i<i_end;i+=skip){
 
-		size_t ii = itr(i);
-		// cout<<"ii : "<<ii<<endl;
+		//walk the scan column by column, as the driver stores it
+		int col = i / rings;
+		int ring = i % rings;
+		int q = img.at(ring, col);
+		int src = img.source(q);
+		if(src < 0) continue;
 		Vector3f p_q;
 		p_q << 
-			pc->points[ii].x,
-			pc->points[ii].y,
-			pc->points[ii].z;
+			img.x(q),
+			img.y(q),
+			img.z(q);
 
 
 		// Vector3i rgb;
 		// rgb << 
-			// unsigned(pc->points[ii].r),
-			// unsigned(pc->points[ii].g),
-			// unsigned(pc->points[ii].b);
+			// unsigned(pc->points[src].r),
+			// unsigned(pc->points[src].g),
+			// unsigned(pc->points[src].b);
 		// if(rgb(0)!=0 && rgb(1)!=0 && rgb(2)!=0){
 			// cout<<"rgb : "<<rgb<<endl;
 		// }
-		uint8_t r = pc->points[ii].r;
-		uint8_t g = pc->points[ii].g;
-		uint8_t b = pc->points[ii].b;
+		uint8_t r = pc->points[src].r;
+		uint8_t g = pc->points[src].g;
+		uint8_t b = pc->points[src].b;
 
 
 		if(!is_valid(p_q.norm()))continue;
-		float tmp_d = p_q.norm();
 
 		if(p_q.norm() < MIN_RANGE)continue;
 
-		MatrixXf A(MatrixXf::Zero(3,(2*HNN+1)*(2*VNN+1)) );
-		unsigned int cnt = 0;
-		//initialize of centroid point.
-		Vector3f cent(Vector3f::Zero(3));
-
-
-		for(int j=-VNN;j<=VNN;j++){
-			//本点と垂点ベクトル
-			Vector3f v_v;
-			Vector3f p_v;
-			if(!jud((int)i+j)) continue;
-			size_t v_idx = itr(i+j);
-			p_v <<
-				pc->points[v_idx].x,
-				pc->points[v_idx].y,
-				pc->points[v_idx].z;
-			//v_v : vector_vertical
-			v_v = p_v - p_q;
-
-			float norm_vv = v_v.norm();
-			//if(! (norm_vv < 0.1*pow(tmp_d,1.8)) ) continue;
-			if(! (norm_vv < vector_vertical*0.0216*pow(tmp_d,1.8967)) ) continue;
-			//if(! (norm_vv < 3.0*0.0216*pow(tmp_d,1.8)) ) continue;
-
-			for(int k=-HNN;k<=HNN;k++){
-
-				if(!jud((int)i+j+32*k)) continue;
-				size_t num_tmp = itr(i+j+32*k);
-				Vector3f p_h;
-				Vector3f v_h;
-
-				//p_h : horizontal point
-				p_h <<
-					pc->points[num_tmp].x,
-					pc->points[num_tmp].y,
-					pc->points[num_tmp].z;
-
-				if(!is_valid(p_h.norm()))continue;
-				//v_h : horizontal vector
-				v_h << p_h - p_v;
-
-				float norm_vh = v_h.norm();
-				//if(( norm_vh < 0.5 ) && ( fabs((int)(i%VN)-(int)((i+j+32*k)%VN)) ) <= VNN ){		//2013.11.10変更後
-				if(( norm_vh < vector_horizon*p_q.norm() ) && ( fabs((int)(i%VN)-(int)((i+j+32*k)%VN)) ) <= VNN ){		//2013.11.10変更後
-					A.col(cnt) = p_h;
-					cent += p_h;
-					cnt ++;
-				}
-			}
-			}
-
+		Vector3f cent;
+		Matrix3f cov;
+		unsigned int cnt;
+		if(INTEGRAL) cnt = window_moments(ring, col, cent, cov);
+		else cnt = neighbour_moments(ring, col, p_q, cent, cov);
+		if(cnt == 0) continue;
 
 			float density = (float)cnt/((2*VNN+1)*(2*HNN+1));
 			if(density < DENS)continue;
 
-			cent /= (float)cnt;
-			for(size_t a = 0;a<cnt;a++){
-				A.col(a) = A.col(a) - cent;
-			}
-
-
-			JacobiSVD<MatrixXf> svd(A, ComputeThinU | ComputeThinV);
-			Matrix3f U = svd.matrixU();
-			Vector3f S = svd.singularValues();
+			//closed-form eigen decomposition of the 3x3 scatter matrix (ascending eigenvalues).
+			//singular values of the centred neighbour matrix = sqrt of these eigenvalues.
+			SelfAdjointEigenSolver<Matrix3f> es;
+			es.computeDirect(cov);
+			Vector3f S;
+			S <<
+				sqrt(max(es.eigenvalues()(2), 0.0f)),
+				sqrt(max(es.eigenvalues()(1), 0.0f)),
+				sqrt(max(es.eigenvalues()(0), 0.0f));
 
 			Vector3f vec_n;
-			vec_n = U.col(2);
+			vec_n = es.eigenvectors().col(0);
 			//正規化処理@2013.11.11
 			vec_n.normalize();
 			if(alignment(p_q, vec_n)) vec_n *= -1.0;
@@ -569,7 +530,7 @@ void pc_callback(sensor_msgs::PointCloud2::Ptr msg)
 		ros::init(argc, argv, "NormalEstimationForVelodyne");
 		ros::NodeHandle n;
 		ros::Rate roop(2);
-		getParams(n);
+		if(!getParams(n)) return -1;
 		// ros::Subscriber sub = n.subscribe("/velodyne_points",1,pc_callback);
 		ros::Subscriber sub = n.subscribe("/velodyne_colored_points/full",1,pc_callback);
 		//	pub = n.advertise<sensor_msgs::PointCloud>("perfect_velodyne",1);
@@ -0,0 +1,205 @@
+/*
+ * scan_preprocessor.cpp
+ *
+ * Traversals of ScanPreprocessor::process, in order:
+ *   RangeImage::build   the only read of the message (x, y, z, rgb)
+ *   moments_.compute    integral images; every pixel is classified
+ *                       (classifyPixel) as the ring sweep reaches it
+ *   estimateNormals     ring-window normals, curvature, smoothing and the
+ *                       height map cell of every point with a normal
+ *   buildHeightMap      min/max z of every touched grid cell
+ *   labelPixels         ground/obstacle labels from the cell heights
+ * Each one needs the previous one complete: a window can only be read from
+ * the finished summed-area table, a cell's min/max only exists after all of
+ * its (smoothed) points, and a label needs the finished min/max. All of
+ * them except the height map reduction run in parallel over pixels.
+ */
+
+#include <deep_learning_object_detection/scan_preprocessor.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+
+using namespace std;
+using namespace Eigen;
+
+namespace scan_preprocessing
+{
+
+ScanPreprocessor::ScanPreprocessor(const PreprocessParams &params)
+{
+	setParams(params);
+}
+
+void ScanPreprocessor::setParams(const PreprocessParams &params)
+{
+	params_ = params;
+	img_.setSensorModel(params_.sensor);
+
+	size_t cells = (size_t)params_.grid_dim * params_.grid_dim;
+	cell_min_.assign(cells, 0.0f);
+	cell_max_.assign(cells, 0.0f);
+	cell_init_.assign(cells, 0);
+	touched_.clear();
+}
+
+bool ScanPreprocessor::process(const sensor_msgs::PointCloud2 &msg)
+{
+	if(!img_.build(msg)) return false;
+	attr_.resize(img_.size());
+
+	moments_.compute(img_,
+			[this](int i){ return classifyPixel(i); },
+			[this](int i, int j){ return hEdge(i, j); },
+			[this](int i, int j){ return vEdge(i, j); });
+	estimateNormals();
+	buildHeightMap();
+	labelPixels();
+	return true;
+}
+
+// relative range jump between neighbours on one ring
+bool ScanPreprocessor::hEdge(int i, int j) const
+{
+	float ri = img_.range(i);
+	float rj = img_.range(j);
+	if(!validRange(ri) || !validRange(rj)) return false;
+	return fabs(ri - rj) > params_.thresh_d * min(ri, rj);
+}
+
+// distance between neighbouring rings against the expected ring spacing
+bool ScanPreprocessor::vEdge(int i, int j) const
+{
+	float ri = img_.range(i);
+	float rj = img_.range(j);
+	if(!validRange(ri) || !validRange(rj)) return false;
+	Vector3f d(img_.x(j) - img_.x(i), img_.y(j) - img_.y(i), img_.z(j) - img_.z(i));
+	return !(d.norm() < params_.vector_vertical * 0.0216 * pow(min(ri, rj), 1.8967));
+}
+
+// resets the attributes of pixel i, true if it is VALID; called once per pixel
+bool ScanPreprocessor::classifyPixel(int i)
+{
+	bool valid = img_.source(i) >= 0 && validRange(img_.range(i));
+	attr_.flags[i] = valid ? VALID : 0;
+	attr_.px[i] = img_.x(i);
+	attr_.py[i] = img_.y(i);
+	attr_.pz[i] = img_.z(i);
+	attr_.nx[i] = attr_.ny[i] = attr_.nz[i] = 0.0f;
+	attr_.curvature[i] = 0.0f;
+	attr_.cell[i] = -1;
+	return valid;
+}
+
+// height map cell of a point, -1 outside the grid
+int ScanPreprocessor::cellOf(float x, float y) const
+{
+	int grid = params_.grid_dim;
+	int cx = ((grid / 2) + x / params_.cell_size);
+	int cy = ((grid / 2) + y / params_.cell_size);
+	if(cx < 0 || cx >= grid || cy < 0 || cy >= grid) return -1;
+	return cx * grid + cy;
+}
+
+void ScanPreprocessor::estimateNormals()
+{
+	int rings = img_.rings();
+	int cols = img_.cols();
+	int col_end = min(cols, (int)ceil(cols * params_.view_ratio));
+	int n = rings * col_end;
+	float window = (2 * params_.vnn + 1) * (2 * params_.hnn + 1);
+
+#pragma omp parallel for schedule(dynamic, 256)
+	for(int k = 0; k < n; k++){
+		int ring = k / col_end;
+		int col = k % col_end;
+		int q = img_.at(ring, col);
+		if(!(attr_.flags[q] & VALID)) continue;
+
+		int r0, r1, c0, c1;
+		moments_.edgeFreeWindow(ring, col, params_.hnn, params_.vnn, r0, r1, c0, c1);
+		range_image::Moments m;
+		moments_.window(r0, r1, c0, c1, m);
+		if(m.n < 0.5 || m.n / window < params_.dens) continue;
+
+		Vector3f cent;
+		Matrix3f cov;
+		m.centroidAndScatter(cent, cov);
+
+		SelfAdjointEigenSolver<Matrix3f> es;
+		es.computeDirect(cov);
+		float s0 = sqrt(max(es.eigenvalues()(2), 0.0f));
+		float s1 = sqrt(max(es.eigenvalues()(1), 0.0f));
+		float s2 = sqrt(max(es.eigenvalues()(0), 0.0f));
+		float curv = 3.0 * s2 / (s0 + s1 + s2);
+		if(!(curv == curv)) continue;
+
+		Vector3f p_q(img_.x(q), img_.y(q), img_.z(q));
+		Vector3f vec_n = es.eigenvectors().col(0).normalized();
+		if(p_q.dot(vec_n) > 0.0) vec_n *= -1.0;
+
+		if(params_.smoothing){
+			float w = 1.0 - pow(curv, 0.3f);
+			w *= w;
+			p_q += w * vec_n.dot(cent - p_q) * vec_n;
+		}
+
+		attr_.flags[q] |= HAS_NORMAL;
+		attr_.px[q] = p_q(0);
+		attr_.py[q] = p_q(1);
+		attr_.pz[q] = p_q(2);
+		// same sign as /perfect_velodyne/normal
+		attr_.nx[q] = -vec_n(0);
+		attr_.ny[q] = -vec_n(1);
+		attr_.nz[q] = -vec_n(2);
+		attr_.curvature[q] = curv;
+		attr_.cell[q] = cellOf(p_q(0), p_q(1));
+	}
+}
+
+void ScanPreprocessor::buildHeightMap()
+{
+	for(size_t k = 0; k < touched_.size(); k++){
+		cell_init_[touched_[k]] = 0;
+	}
+	touched_.clear();
+
+	int n = img_.size();
+	for(int i = 0; i < n; i++){
+		int c = attr_.cell[i];
+		if(c < 0) continue;
+		float z = attr_.pz[i];
+		if(!cell_init_[c]){
+			cell_init_[c] = 1;
+			cell_min_[c] = cell_max_[c] = z;
+			touched_.push_back(c);
+		}
+		else{
+			cell_min_[c] = min(cell_min_[c], z);
+			cell_max_[c] = max(cell_max_[c], z);
+		}
+	}
+}
+
+// same rule as HeightMap::constructFullClouds
+void ScanPreprocessor::labelPixels()
+{
+	int n = img_.size();
+#pragma omp parallel for
+	for(int i = 0; i < n; i++){
+		int c = attr_.cell[i];
+		if(c < 0 || attr_.pz[i] > params_.max_obstacle_z) continue;
+		float diff = cell_max_[c] - cell_min_[c];
+		if(diff > params_.height_threshold && diff < params_.max_height_diff){
+			attr_.flags[i] |= OBSTACLE;
+		}
+		else{
+			attr_.flags[i] |= GROUND;
+		}
+	}
+}
+
+} // namespace scan_preprocessing
@@ -0,0 +1,141 @@
+/*
+ * scan_preprocessor_node.cpp
+ *
+ * One node in place of the normal estimator -> height map chain. The
+ * crop box cloud /velodyne_points/constraint stays with
+ * make_pedestrian_dataset/velodyne_range_constraint. Subscribes to the coloured revolution and publishes
+ * the same topics, each generated from the per-pixel attribute arrays and
+ * only when somebody listens.
+ */
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <deep_learning_object_detection/scan_preprocessor.h>
+
+using namespace std;
+
+typedef pcl::PointXYZRGBNormal PointN;
+typedef pcl::PointCloud<PointN> CloudN;
+
+scan_preprocessing::ScanPreprocessor preprocessor;
+
+ros::Publisher pub_normal;
+ros::Publisher pub_normal_sphere;
+ros::Publisher pub_obstacles;
+ros::Publisher pub_clear;
+
+// points with the given flag, in scan order
+template<class Fill>
+void publishSelected(ros::Publisher &pub, uint8_t flag, const std_msgs::Header &header, Fill fill)
+{
+	if(pub.getNumSubscribers() == 0) return;
+
+	const scan_preprocessing::ScanAttributes &attr = preprocessor.attributes();
+	size_t n = preprocessor.size();
+	CloudN cloud;
+	cloud.points.reserve(n);
+	for(size_t i = 0; i < n; i++){
+		if(!(attr.flags[i] & flag)) continue;
+		PointN p;
+		if(fill(i, p)) cloud.points.push_back(p);
+	}
+	cloud.width = cloud.points.size();
+	cloud.height = 1;
+
+	sensor_msgs::PointCloud2 pc2;
+	pcl::toROSMsg(cloud, pc2);
+	pc2.header = header;
+	pub.publish(pc2);
+}
+
+bool fillNormalPoint(size_t i, PointN &p)
+{
+	const range_image::RangeImage &img = preprocessor.image();
+	const scan_preprocessing::ScanAttributes &attr = preprocessor.attributes();
+	p.x = attr.px[i];
+	p.y = attr.py[i];
+	p.z = attr.pz[i];
+	p.normal_x = attr.nx[i];
+	p.normal_y = attr.ny[i];
+	p.normal_z = attr.nz[i];
+	p.curvature = attr.curvature[i];
+	uint32_t rgb = img.hasRgb() ? img.rgb(i) : 0;
+	p.r = (rgb >> 16) & 0xff;
+	p.g = (rgb >> 8) & 0xff;
+	p.b = rgb & 0xff;
+	return true;
+}
+
+void pc_callback(const sensor_msgs::PointCloud2ConstPtr &msg)
+{
+	if(!preprocessor.process(*msg)){
+		ROS_WARN_THROTTLE(5.0, "scan_preprocessor: cloud without float x, y, z");
+		return;
+	}
+	const scan_preprocessing::ScanAttributes &attr = preprocessor.attributes();
+
+	publishSelected(pub_normal, scan_preprocessing::HAS_NORMAL, msg->header, fillNormalPoint);
+
+	// normals as points on the unit sphere (normal_sphere of the normal estimator)
+	publishSelected(pub_normal_sphere, scan_preprocessing::HAS_NORMAL, msg->header,
+			[&](size_t i, PointN &p){
+				if(attr.curvature[i] >= 0.18) return false;
+				p.x = attr.nx[i];
+				p.y = attr.ny[i];
+				p.z = attr.nz[i];
+				p.normal_x = 0.0;
+				p.normal_y = 0.0;
+				p.normal_z = 1.0;
+				p.curvature = attr.curvature[i];
+				return true;
+			});
+
+	publishSelected(pub_obstacles, scan_preprocessing::OBSTACLE, msg->header, fillNormalPoint);
+	publishSelected(pub_clear, scan_preprocessing::GROUND, msg->header, fillNormalPoint);
+}
+
+int main(int argc, char** argv)
+{
+	ros::init(argc, argv, "scan_preprocessor");
+	ros::NodeHandle n;
+	ros::NodeHandle priv_nh("~");
+
+	scan_preprocessing::PreprocessParams params;
+	string sensor;
+	priv_nh.param<string>("sensor", sensor, "HDL-32");
+	if(!range_image::sensorModelFromString(sensor, params.sensor)){
+		ROS_WARN_STREAM("unknown sensor " << sensor << ", using HDL-32");
+	}
+	priv_nh.param("min_range", params.min_range, params.min_range);
+	priv_nh.param("max_range", params.max_range, params.max_range);
+	priv_nh.param("view_ratio", params.view_ratio, params.view_ratio);
+	priv_nh.param("hnn", params.hnn, params.hnn);
+	priv_nh.param("vnn", params.vnn, params.vnn);
+	priv_nh.param("thresh_d", params.thresh_d, params.thresh_d);
+	priv_nh.param("vector_vertical", params.vector_vertical, params.vector_vertical);
+	priv_nh.param("dens", params.dens, params.dens);
+	priv_nh.param("smoothing", params.smoothing, params.smoothing);
+	priv_nh.param("grid_dimensions", params.grid_dim, params.grid_dim);
+	priv_nh.param("cell_size", params.cell_size, params.cell_size);
+	priv_nh.param("height_threshold", params.height_threshold, params.height_threshold);
+	preprocessor.setParams(params);
+
+	string input_topic;
+	priv_nh.param<string>("input_topic", input_topic, "/velodyne_colored_points/full");
+
+	pub_normal = n.advertise<sensor_msgs::PointCloud2>("perfect_velodyne/normal/colored", 1);
+	pub_normal_sphere = n.advertise<sensor_msgs::PointCloud2>("perfect_velodyne/normal_sphere", 1);
+	pub_obstacles = n.advertise<sensor_msgs::PointCloud2>("velodyne_obstacles", 1);
+	pub_clear = n.advertise<sensor_msgs::PointCloud2>("velodyne_clear", 1);
+
+	ros::Subscriber sub = n.subscribe(input_topic, 1, pc_callback);
+
+	ROS_INFO_STREAM("scan_preprocessor start (" << sensor << ", " << input_topic << ")");
+	ros::spin();
+	return 0;
+}
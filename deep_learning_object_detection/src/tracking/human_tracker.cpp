@@ -0,0 +1,293 @@
+/*
+ * human_tracker.cpp
+ *
+ * HumanTracker::update, in order:
+ *   predict     constant-velocity prediction of every track
+ *   associate   spatial hash gating, components, Hungarian per component
+ *   correct     Kalman update of the matched tracks
+ * then the bookkeeping of missed tracks and new ones.
+ */
+
+#include <deep_learning_object_detection/human_tracker.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <Eigen/LU>
+
+using namespace std;
+using namespace Eigen;
+
+namespace tracking
+{
+
+void solveAssignment(const vector<double> &cost, int n, int m, vector<int> &assignment)
+{
+	const double inf = numeric_limits<double>::infinity();
+	// 1-based potentials; p[j] is the row assigned to column j, 0 : none
+	vector<double> u(n + 1, 0.0), v(m + 1, 0.0), minv(m + 1);
+	vector<int> p(m + 1, 0), way(m + 1, 0);
+	vector<char> used(m + 1);
+	for(int i = 1; i <= n; i++){
+		p[0] = i;
+		int j0 = 0;
+		fill(minv.begin(), minv.end(), inf);
+		fill(used.begin(), used.end(), 0);
+		do{
+			used[j0] = 1;
+			int i0 = p[j0], j1 = 0;
+			double delta = inf;
+			for(int j = 1; j <= m; j++){
+				if(used[j]) continue;
+				double cur = cost[(i0 - 1) * m + (j - 1)] - u[i0] - v[j];
+				if(cur < minv[j]){
+					minv[j] = cur;
+					way[j] = j0;
+				}
+				if(minv[j] < delta){
+					delta = minv[j];
+					j1 = j;
+				}
+			}
+			for(int j = 0; j <= m; j++){
+				if(used[j]){
+					u[p[j]] += delta;
+					v[j] -= delta;
+				}
+				else{
+					minv[j] -= delta;
+				}
+			}
+			j0 = j1;
+		}while(p[j0] != 0);
+		do{
+			int j1 = way[j0];
+			p[j0] = p[j1];
+			j0 = j1;
+		}while(j0);
+	}
+
+	assignment.assign(n, -1);
+	for(int j = 1; j <= m; j++){
+		if(p[j] > 0) assignment[p[j] - 1] = j - 1;
+	}
+}
+
+HumanTracker::HumanTracker(const TrackerParams &params) :
+	params_(params), next_id_(0), last_stamp_(0.0), initialized_(false)
+{
+}
+
+void HumanTracker::update(double stamp, const vector<Detection> &detections)
+{
+	double dt = stamp - last_stamp_;
+	if(!initialized_ || dt < 0.0 || dt > params_.max_dt){
+		tracks_.clear();
+		dt = 0.0;
+	}
+	initialized_ = true;
+	last_stamp_ = stamp;
+
+	predict(dt);
+
+	vector<int> track_of;
+	associate(detections, track_of);
+
+	for(size_t t = 0; t < tracks_.size(); t++){
+		tracks_[t].detection = -1;
+	}
+	for(size_t d = 0; d < detections.size(); d++){
+		if(track_of[d] < 0) continue;
+		Track &track = tracks_[track_of[d]];
+		correct(track, detections[d]);
+		track.detection = d;
+		track.hits++;
+		track.misses = 0;
+	}
+
+	// tentative tracks die on their first miss
+	size_t kept = 0;
+	for(size_t t = 0; t < tracks_.size(); t++){
+		Track &track = tracks_[t];
+		if(track.detection < 0) track.misses++;
+		if(track.misses > params_.max_misses || (!confirmed(track) && track.misses > 0)) continue;
+		if(kept != t) tracks_[kept] = track;
+		kept++;
+	}
+	tracks_.resize(kept);
+
+	double r2 = params_.meas_noise * params_.meas_noise;
+	for(size_t d = 0; d < detections.size(); d++){
+		if(track_of[d] >= 0) continue;
+		Track track;
+		track.id = next_id_++;
+		track.x << detections[d].x, detections[d].y, 0.0, 0.0;
+		track.z = detections[d].z;
+		track.P = Vector4d(r2, r2, params_.init_vel_var, params_.init_vel_var).asDiagonal();
+		track.hits = 1;
+		track.misses = 0;
+		track.detection = d;
+		tracks_.push_back(track);
+	}
+}
+
+void HumanTracker::predict(double dt)
+{
+	if(dt <= 0.0) return;
+	Matrix4d F = Matrix4d::Identity();
+	F(0, 2) = dt;
+	F(1, 3) = dt;
+
+	// white noise acceleration, per axis q * [dt^4/4 dt^3/2; dt^3/2 dt^2]
+	double q = params_.accel_noise * params_.accel_noise;
+	double a = q * pow(dt, 4) / 4.0, b = q * pow(dt, 3) / 2.0, c = q * dt * dt;
+	Matrix4d Q = Matrix4d::Zero();
+	Q(0, 0) = Q(1, 1) = a;
+	Q(0, 2) = Q(2, 0) = Q(1, 3) = Q(3, 1) = b;
+	Q(2, 2) = Q(3, 3) = c;
+
+	for(size_t t = 0; t < tracks_.size(); t++){
+		tracks_[t].x = F * tracks_[t].x;
+		tracks_[t].P = F * tracks_[t].P * F.transpose() + Q;
+	}
+}
+
+void HumanTracker::correct(Track &track, const Detection &detection)
+{
+	// H = [I 0], so S and K only need the position block
+	Matrix2d S = track.P.topLeftCorner<2, 2>();
+	S.diagonal().array() += params_.meas_noise * params_.meas_noise;
+	Matrix<double, 4, 2> K = track.P.leftCols<2>() * S.inverse();
+
+	Vector2d innovation(detection.x - track.x(0), detection.y - track.x(1));
+	track.x += K * innovation;
+	track.P -= K * track.P.topRows<2>();
+	track.z = detection.z;
+}
+
+int64_t HumanTracker::cellKey(double x, double y) const
+{
+	int64_t ix = (int64_t)floor(x / params_.gate);
+	int64_t iy = (int64_t)floor(y / params_.gate);
+	return (int64_t)(((uint64_t)(ix & 0xffffffff) << 32) | (uint64_t)(iy & 0xffffffff));
+}
+
+int HumanTracker::find(int i)
+{
+	while(parent_[i] != i){
+		parent_[i] = parent_[parent_[i]];
+		i = parent_[i];
+	}
+	return i;
+}
+
+void HumanTracker::associate(const vector<Detection> &detections, vector<int> &track_of)
+{
+	int nt = tracks_.size();
+	int nd = detections.size();
+	track_of.assign(nd, -1);
+	if(nt == 0 || nd == 0) return;
+
+	// buckets are kept between frames, the map is only dropped when it grows
+	if(cells_.size() > 4096) cells_.clear();
+	for(unordered_map<int64_t, vector<int> >::iterator it = cells_.begin(); it != cells_.end(); ++it){
+		it->second.clear();
+	}
+	for(int t = 0; t < nt; t++){
+		cells_[cellKey(tracks_[t].x(0), tracks_[t].x(1))].push_back(t);
+	}
+
+	// gated pairs; tracks are nodes [0, nt), detections [nt, nt + nd)
+	double gate2 = params_.gate * params_.gate;
+	edge_track_.clear();
+	edge_detection_.clear();
+	parent_.resize(nt + nd);
+	for(int i = 0; i < nt + nd; i++) parent_[i] = i;
+	for(int d = 0; d < nd; d++){
+		const Detection &det = detections[d];
+		for(int dx = -1; dx <= 1; dx++){
+			for(int dy = -1; dy <= 1; dy++){
+				unordered_map<int64_t, vector<int> >::const_iterator cell
+					= cells_.find(cellKey(det.x + dx * params_.gate, det.y + dy * params_.gate));
+				if(cell == cells_.end()) continue;
+				for(size_t k = 0; k < cell->second.size(); k++){
+					int t = cell->second[k];
+					double ex = det.x - tracks_[t].x(0), ey = det.y - tracks_[t].x(1);
+					if(ex * ex + ey * ey > gate2) continue;
+					edge_track_.push_back(t);
+					edge_detection_.push_back(d);
+					int a = find(t), b = find(nt + d);
+					if(a != b) parent_[a] = b;
+				}
+			}
+		}
+	}
+
+	// members of every component with at least one pair
+	vector<int> group(nt + nd, -1);
+	vector<char> seen(nt + nd, 0);
+	vector< vector<int> > group_tracks, group_detections;
+	for(size_t e = 0; e < edge_track_.size(); e++){
+		int t = edge_track_[e], d = edge_detection_[e];
+		int root = find(t);
+		if(group[root] < 0){
+			group[root] = group_tracks.size();
+			group_tracks.push_back(vector<int>());
+			group_detections.push_back(vector<int>());
+		}
+		if(!seen[t]){
+			seen[t] = 1;
+			group_tracks[group[root]].push_back(t);
+		}
+		if(!seen[nt + d]){
+			seen[nt + d] = 1;
+			group_detections[group[root]].push_back(d);
+		}
+	}
+
+	for(size_t g = 0; g < group_tracks.size(); g++){
+		if(group_tracks[g].size() == 1 && group_detections[g].size() == 1){
+			track_of[group_detections[g][0]] = group_tracks[g][0];
+		}
+		else{
+			solveGroup(group_tracks[g], group_detections[g], detections, track_of);
+		}
+	}
+}
+
+void HumanTracker::solveGroup(const vector<int> &group_tracks, const vector<int> &group_detections,
+							  const vector<Detection> &detections, vector<int> &track_of)
+{
+	// rows are the smaller side
+	bool rows_are_tracks = group_tracks.size() <= group_detections.size();
+	const vector<int> &rows = rows_are_tracks ? group_tracks : group_detections;
+	const vector<int> &cols = rows_are_tracks ? group_detections : group_tracks;
+	int n = rows.size(), m = cols.size();
+
+	// pairs outside the gate cost more than any set of gated pairs
+	double gate2 = params_.gate * params_.gate;
+	double outside = gate2 * (n + 1) * 10.0;
+	vector<double> cost(n * m);
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j < m; j++){
+			int t = rows_are_tracks ? rows[i] : cols[j];
+			int d = rows_are_tracks ? cols[j] : rows[i];
+			double ex = detections[d].x - tracks_[t].x(0), ey = detections[d].y - tracks_[t].x(1);
+			double e2 = ex * ex + ey * ey;
+			cost[i * m + j] = e2 <= gate2 ? e2 : outside;
+		}
+	}
+
+	vector<int> assignment;
+	solveAssignment(cost, n, m, assignment);
+	for(int i = 0; i < n; i++){
+		int j = assignment[i];
+		if(j < 0 || cost[i * m + j] >= outside) continue;
+		int t = rows_are_tracks ? rows[i] : cols[j];
+		int d = rows_are_tracks ? cols[j] : rows[i];
+		track_of[d] = t;
+	}
+}
+
+} // namespace tracking
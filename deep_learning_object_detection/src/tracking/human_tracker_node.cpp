@@ -0,0 +1,167 @@
+/*
+ * human_tracker_node.cpp
+ *
+ * Tracks every cluster descriptor that is shaped like a person and
+ * publishes all confirmed tracks in one MarkerArray, in the layout the
+ * /velocity_arrows consumers read: one ARROW per track with id = track id,
+ * pose = position and heading, scale.x = speed.
+ *
+ * The consumers expect world-frame velocities like the motion capture
+ * data, so the tracks are filtered in fixed_frame. Tracking in the moving
+ * velodyne frame would add the ego-motion to every speed and heading.
+ */
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <visualization_msgs/Marker.h>
+#include <visualization_msgs/MarkerArray.h>
+
+#include <tf/tf.h>
+#include <tf/transform_listener.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <deep_learning_object_detection/cluster_descriptor.h>
+#include <deep_learning_object_detection/human_tracker.h>
+
+#include <sstream>
+
+using namespace std;
+
+typedef pcl::PointCloud<clustering::ClusterDescriptor> DescriptorCloud;
+
+tracking::HumanTracker tracker;
+
+ros::Publisher pub_tracks;
+tf::TransformListener *listener;
+
+// tracking frame, empty : the frame of the descriptors (not for /velocity_arrows)
+string fixed_frame;
+// size of a person
+double min_height = 0.5;
+double max_height = 2.2;
+double max_footprint = 1.2;
+
+bool human_shaped(const clustering::ClusterDescriptor &d)
+{
+	return d.height >= min_height && d.height <= max_height && max(d.length, d.width) <= max_footprint;
+}
+
+void set_marker(const tracking::Track &track, const std_msgs::Header &header, visualization_msgs::Marker &marker)
+{
+	marker.header = header;
+
+	marker.id = track.id;
+
+	ostringstream ss;
+	ss << track.id;
+	marker.ns = "human_" + ss.str();
+
+	marker.type = visualization_msgs::Marker::ARROW;
+	marker.action = visualization_msgs::Marker::ADD;
+
+	marker.lifetime = ros::Duration(0.1);
+
+	marker.color.r = 228.0 / 255.0;
+	marker.color.g = 162.0 / 255.0;
+	marker.color.b = 11.0 / 255.0;
+	marker.color.a = 1.0;
+
+	marker.pose.position.x = track.x(0);
+	marker.pose.position.y = track.x(1);
+	marker.pose.position.z = track.z;
+	marker.pose.orientation = tf::createQuaternionMsgFromYaw(atan2(track.x(3), track.x(2)));
+
+	// speed in scale.x, as the other /velocity_arrows publishers
+	marker.scale.x = track.x.tail<2>().norm();
+	marker.scale.y = 0.1;
+	marker.scale.z = 0.1;
+}
+
+void descriptorsCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
+{
+	DescriptorCloud descriptors;
+	pcl::fromROSMsg(*msg, descriptors);
+
+	std_msgs::Header header = msg->header;
+	tf::StampedTransform transform;
+	transform.setIdentity();
+	if(!fixed_frame.empty()){
+		try{
+			listener->waitForTransform(fixed_frame, msg->header.frame_id, msg->header.stamp, ros::Duration(0.1));
+			listener->lookupTransform(fixed_frame, msg->header.frame_id, msg->header.stamp, transform);
+		}
+		catch(tf::TransformException &ex){
+			ROS_WARN_THROTTLE(5.0, "human_tracker : %s", ex.what());
+			return;
+		}
+		header.frame_id = fixed_frame;
+	}
+
+	vector<tracking::Detection> detections;
+	detections.reserve(descriptors.points.size());
+	for(size_t i = 0; i < descriptors.points.size(); i++){
+		const clustering::ClusterDescriptor &d = descriptors.points[i];
+		if(!human_shaped(d)) continue;
+		tf::Vector3 p = transform * tf::Vector3(d.x, d.y, d.z);
+		tracking::Detection det;
+		det.x = p.x();
+		det.y = p.y();
+		det.z = p.z();
+		det.index = i;
+		detections.push_back(det);
+	}
+
+	tracker.update(msg->header.stamp.toSec(), detections);
+
+	visualization_msgs::MarkerArray tracks;
+	const vector<tracking::Track> &list = tracker.tracks();
+	for(size_t i = 0; i < list.size(); i++){
+		if(!tracker.confirmed(list[i])) continue;
+		visualization_msgs::Marker marker;
+		set_marker(list[i], header, marker);
+		tracks.markers.push_back(marker);
+	}
+	pub_tracks.publish(tracks);
+}
+
+int main(int argc, char** argv)
+{
+	ros::init(argc, argv, "human_tracker");
+	ros::NodeHandle n;
+	ros::NodeHandle priv_nh("~");
+
+	tracking::TrackerParams params;
+	priv_nh.param("gate", params.gate, params.gate);
+	priv_nh.param("accel_noise", params.accel_noise, params.accel_noise);
+	priv_nh.param("meas_noise", params.meas_noise, params.meas_noise);
+	priv_nh.param("min_hits", params.min_hits, params.min_hits);
+	priv_nh.param("max_misses", params.max_misses, params.max_misses);
+	priv_nh.param("max_dt", params.max_dt, params.max_dt);
+	tracker.setParams(params);
+
+	priv_nh.param("min_height", min_height, min_height);
+	priv_nh.param("max_height", max_height, max_height);
+	priv_nh.param("max_footprint", max_footprint, max_footprint);
+	priv_nh.param<string>("fixed_frame", fixed_frame, "/map");
+
+	string output_topic;
+	priv_nh.param<string>("output_topic", output_topic, "/velocity_arrows");
+	if(fixed_frame.empty() && output_topic == "/velocity_arrows"){
+		ROS_ERROR("human_tracker : /velocity_arrows needs world-frame tracks, set ~fixed_frame");
+		return 1;
+	}
+
+	tf::TransformListener tf_listener;
+	listener = &tf_listener;
+
+	pub_tracks = n.advertise<visualization_msgs::MarkerArray>(output_topic, 1);
+
+	ros::Subscriber sub_descriptors = n.subscribe("/human_points/descriptors", 1, descriptorsCallback);
+
+	cout<<"Here we go!!"<<endl;
+
+	ros::spin();
+	return 0;
+}
@@ -8,12 +8,16 @@
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
 
+#include <infant_utils/trajectory_buffer.h>
+
 using namespace std;
 
 typedef pcl::PointXYZRGBNormal PointType;
 typedef pcl::PointCloud<PointType> CloudType;
 
 visualization_msgs::Marker trajectory;
+// the marker is rebuilt from this, so it never grows past the capacity
+infant_utils::TrajectoryBuffer history;
 
 ros::Publisher pub_trajectory;
 
@@ -37,13 +41,21 @@ void create_trajectory(CloudType::Ptr centroid,
 	marker.color.b = 1.0;
 	marker.color.a = 1.0;
 
-	geometry_msgs::Point p;
-	p.x = centroid->points[0].x;
-	p.y = centroid->points[0].y;
-	p.z = centroid->points[0].z;
+	infant_utils::TrajectoryPoint sample;
+	sample.x = centroid->points[0].x;
+	sample.y = centroid->points[0].y;
+	sample.z = centroid->points[0].z;
+	sample.stamp = marker_header.stamp;
+
+	if(sample.z > -0.500){
+		history.push(sample);
+	}
 
-	if(p.z > -0.500){
-		marker.points.push_back(p);
+	marker.points.resize(history.size());
+	for(size_t i=0; i<history.size(); i++){
+		marker.points[i].x = history[i].x;
+		marker.points[i].y = history[i].y;
+		marker.points[i].z = history[i].z;
 	}
 }
 
@@ -69,6 +81,16 @@ int main(int argc, char** argv)
 {
 	ros::init(argc, argv, "trajectory_visualizer");
 	ros::NodeHandle n;
+	ros::NodeHandle priv_nh("~");
+
+	infant_utils::TrajectoryParams params;
+	int capacity = params.capacity;
+	priv_nh.param("capacity", capacity, capacity);
+	priv_nh.param("min_distance", params.min_distance, params.min_distance);
+	priv_nh.param("min_interval", params.min_interval, params.min_interval);
+	priv_nh.param("simplify_tolerance", params.simplify_tolerance, params.simplify_tolerance);
+	params.capacity = capacity;
+	history.setParams(params);
 
 	pub_trajectory = n.advertise<visualization_msgs::Marker>("/human_points/centroid/trajectory", 1);
 
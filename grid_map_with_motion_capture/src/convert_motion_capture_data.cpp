@@ -14,12 +14,15 @@
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
+#include <infant_utils/trajectory_buffer.h>
+
 #include <stdio.h>
 #include <math.h>
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <map>
 #include <time.h>
 
 using namespace std;
@@ -33,6 +36,8 @@ class CvtMocapData
 		ros::Publisher other_agents_velocity_pub_;
 		ros::Publisher my_agent_tracking_pub_;
 		ros::Publisher other_agents_tracking_pub_;
+		ros::Publisher my_agent_trajectory_pub_;
+		ros::Publisher other_agents_trajectory_pub_;
 
 		geometry_msgs::PoseStamped get_map_pose(geometry_msgs::PoseStamped mocap_pose);
 		void set_marker(visualization_msgs::Marker &marker, 
@@ -41,6 +46,7 @@ class CvtMocapData
 					    geometry_msgs::PoseStamped pose);
 
 		void set_pointcloud(visualization_msgs::Marker marker);
+		void create_trajectory_pointclouds(void);
 
 		void mocapVelocityCallback(visualization_msgs::MarkerArray msg);
 
@@ -50,6 +56,15 @@ class CvtMocapData
 		tf::TransformListener tflistener_;
 		pcl::PointCloud<pcl::PointXYZINormal>::Ptr my_agent_tracking_pc;
 		pcl::PointCloud<pcl::PointXYZINormal>::Ptr other_agents_tracking_pc;
+		pcl::PointCloud<pcl::PointXYZINormal>::Ptr my_agent_trajectory_pc;
+		pcl::PointCloud<pcl::PointXYZINormal>::Ptr other_agents_trajectory_pc;
+
+		// bounded trajectory of every agent, by marker id
+		infant_utils::TrajectoryParams trajectory_params_;
+		map<int, infant_utils::TrajectoryBuffer> trajectories_;
+		// last sample of every agent; trails not updated for trajectory_timeout [s] are dropped
+		map<int, ros::Time> last_update_;
+		double trajectory_timeout_;
 	public:
 		CvtMocapData(ros::NodeHandle &n);
 
@@ -65,10 +80,22 @@ CvtMocapData::CvtMocapData(ros::NodeHandle &n)
 	other_agents_velocity_pub_ = n.advertise<visualization_msgs::MarkerArray>("/other_agents_velocity", 1);
 	my_agent_tracking_pub_ = n.advertise<sensor_msgs::PointCloud2>("/my_agent_velocity/tracking_point", 1);
 	other_agents_tracking_pub_ = n.advertise<sensor_msgs::PointCloud2>("/other_agents_velocity/tracking_point", 1);
+	my_agent_trajectory_pub_ = n.advertise<sensor_msgs::PointCloud2>("/my_agent_velocity/trajectory", 1);
+	other_agents_trajectory_pub_ = n.advertise<sensor_msgs::PointCloud2>("/other_agents_velocity/trajectory", 1);
 
 	my_agent_tracking_pc.reset (new pcl::PointCloud<pcl::PointXYZINormal>);
 	other_agents_tracking_pc.reset (new pcl::PointCloud<pcl::PointXYZINormal>);
-	
+	my_agent_trajectory_pc.reset (new pcl::PointCloud<pcl::PointXYZINormal>);
+	other_agents_trajectory_pc.reset (new pcl::PointCloud<pcl::PointXYZINormal>);
+
+	ros::NodeHandle priv_nh("~");
+	int capacity = trajectory_params_.capacity;
+	priv_nh.param("trajectory_capacity", capacity, capacity);
+	priv_nh.param("trajectory_min_distance", trajectory_params_.min_distance, trajectory_params_.min_distance);
+	priv_nh.param("trajectory_min_interval", trajectory_params_.min_interval, trajectory_params_.min_interval);
+	priv_nh.param("trajectory_simplify_tolerance", trajectory_params_.simplify_tolerance, trajectory_params_.simplify_tolerance);
+	trajectory_params_.capacity = capacity;
+	priv_nh.param("trajectory_timeout", trajectory_timeout_, 1.0);
 }
 
 
@@ -151,6 +178,52 @@ void CvtMocapData::set_pointcloud(visualization_msgs::Marker marker)
 	else{
 		other_agents_tracking_pc->points.push_back(tmp_point);
 	}
+
+	map<int, infant_utils::TrajectoryBuffer>::iterator it = trajectories_.find(marker.id);
+	if(it == trajectories_.end()){
+		it = trajectories_.insert(make_pair(marker.id, infant_utils::TrajectoryBuffer(trajectory_params_))).first;
+	}
+
+	infant_utils::TrajectoryPoint sample;
+	sample.x = marker.pose.position.x;
+	sample.y = marker.pose.position.y;
+	sample.z = marker.pose.position.z;
+	sample.stamp = marker.header.stamp;
+	it->second.push(sample);
+	last_update_[marker.id] = marker.header.stamp;
+}
+
+// trails of the agents seen within trajectory_timeout, one point per kept sample
+void CvtMocapData::create_trajectory_pointclouds(void)
+{
+	my_agent_trajectory_pc->points.clear();
+	other_agents_trajectory_pc->points.clear();
+
+	ros::Time now = ros::Time::now();
+	map<int, infant_utils::TrajectoryBuffer>::iterator it = trajectories_.begin();
+	while(it != trajectories_.end()){
+		if((now - last_update_[it->first]).toSec() > trajectory_timeout_){
+			last_update_.erase(it->first);
+			trajectories_.erase(it++);
+		}
+		else{
+			++it;
+		}
+	}
+
+	for(it = trajectories_.begin(); it != trajectories_.end(); ++it){
+		const infant_utils::TrajectoryBuffer &trajectory = it->second;
+		pcl::PointCloud<pcl::PointXYZINormal>::Ptr pc
+			= it->first == 0 ? my_agent_trajectory_pc : other_agents_trajectory_pc;
+		for(size_t i=0;i<trajectory.size();i++){
+			pcl::PointXYZINormal tmp_point;
+			tmp_point.x = trajectory[i].x;
+			tmp_point.y = trajectory[i].y;
+			tmp_point.z = trajectory[i].z;
+			tmp_point.curvature = it->first;
+			pc->points.push_back(tmp_point);
+		}
+	}
 }
 
 
@@ -209,6 +282,18 @@ void CvtMocapData::mocapVelocityCallback(visualization_msgs::MarkerArray msg)
 	other_agents_tracking_pc2.header = header;
 	other_agents_tracking_pub_.publish(other_agents_tracking_pc2);
 
+	create_trajectory_pointclouds();
+
+	sensor_msgs::PointCloud2 my_agent_trajectory_pc2;
+	pcl::toROSMsg(*my_agent_trajectory_pc, my_agent_trajectory_pc2);
+	my_agent_trajectory_pc2.header = header;
+	my_agent_trajectory_pub_.publish(my_agent_trajectory_pc2);
+
+	sensor_msgs::PointCloud2 other_agents_trajectory_pc2;
+	pcl::toROSMsg(*other_agents_trajectory_pc, other_agents_trajectory_pc2);
+	other_agents_trajectory_pc2.header = header;
+	other_agents_trajectory_pub_.publish(other_agents_trajectory_pc2);
+
 	clock_t end = clock();
 	cout << "duration = " << (double)(end - start) / CLOCKS_PER_SEC << "sec.\n";
 }
@@ -0,0 +1,169 @@
+/*
+ * batch_projection.h
+ *
+ * Pinhole projection of a whole point buffer with a 3 x 4 matrix (the P
+ * of sensor_msgs::CameraInfo, or a CV_32FC1 cv::Mat of the same layout).
+ *
+ * The matrix is padded to 4 x 4 so every point is one packed Eigen
+ * product, and the results go into arrays that are kept between calls:
+ * sub-pixel u, v, the depth (third row of P x) and a mask. A point is
+ * PROJECTION_IN_FRONT for a positive depth and PROJECTION_IN_FRAME when
+ * the pixel it falls in, (int)u and (int)v, is inside the frame.
+ *
+ * Besides point types, packed x, y, z floats in a raw buffer can be
+ * projected in place, e.g. straight from the data of a PointCloud2.
+ *
+ * Header only.
+ */
+
+#ifndef INFANT_UTILS_BATCH_PROJECTION_H_
+#define INFANT_UTILS_BATCH_PROJECTION_H_
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <pcl/point_cloud.h>
+
+namespace infant_utils
+{
+
+enum
+{
+	PROJECTION_IN_FRONT = 1 << 0,
+	PROJECTION_IN_FRAME = 1 << 1,
+	PROJECTION_VISIBLE = PROJECTION_IN_FRONT | PROJECTION_IN_FRAME
+};
+
+class BatchProjection
+{
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	BatchProjection() : x0_(0), y0_(0), x1_(0), y1_(0), visible_(0)
+	{
+		matrix_.setZero();
+	}
+
+	// 3 x 4, row major
+	void setMatrix(const float *p)
+	{
+		matrix_.setZero();
+		for(int r = 0; r < 3; r++){
+			for(int c = 0; c < 4; c++){
+				matrix_(r, c) = p[4 * r + c];
+			}
+		}
+	}
+
+	void setMatrix(const Eigen::Matrix<float, 3, 4> &p)
+	{
+		matrix_.setZero();
+		matrix_.topRows<3>() = p;
+	}
+
+	// pixels [x, x + width) x [y, y + height) are in the frame
+	void setFrame(int x, int y, int width, int height)
+	{
+		x0_ = x;
+		y0_ = y;
+		x1_ = x + width;
+		y1_ = y + height;
+	}
+
+	void setFrame(int width, int height)
+	{
+		setFrame(0, 0, width, height);
+	}
+
+	// any point type with x, y, z; returns the number of visible points
+	template<class PointT>
+	size_t project(const PointT *points, size_t n)
+	{
+		resize(n);
+		for(size_t i = 0; i < n; i++){
+			projectPoint(i, points[i].x, points[i].y, points[i].z);
+		}
+		return visible_;
+	}
+
+	// n points, x, y, z floats packed at xyz and every step bytes on, not aligned
+	size_t project(const uint8_t *xyz, size_t n, size_t step)
+	{
+		resize(n);
+		for(size_t i = 0; i < n; i++, xyz += step){
+			float p[3];
+			memcpy(p, xyz, sizeof(p));
+			projectPoint(i, p[0], p[1], p[2]);
+		}
+		return visible_;
+	}
+
+	template<class PointT>
+	size_t project(const pcl::PointCloud<PointT> &cloud)
+	{
+		return project(cloud.points.empty() ? NULL : &cloud.points[0], cloud.points.size());
+	}
+
+	size_t size() const { return mask_.size(); }
+	size_t visibleCount() const { return visible_; }
+
+	float u(size_t i) const { return u_[i]; }
+	float v(size_t i) const { return v_[i]; }
+	// pixel of a point in front of the camera
+	int col(size_t i) const { return (int)u_[i]; }
+	int row(size_t i) const { return (int)v_[i]; }
+	float depth(size_t i) const { return depth_[i]; }
+	uint8_t mask(size_t i) const { return mask_[i]; }
+	bool visible(size_t i) const { return mask_[i] == PROJECTION_VISIBLE; }
+
+	const std::vector<float> &u() const { return u_; }
+	const std::vector<float> &v() const { return v_; }
+	const std::vector<float> &depth() const { return depth_; }
+	const std::vector<uint8_t> &mask() const { return mask_; }
+
+private:
+	void resize(size_t n)
+	{
+		u_.resize(n);
+		v_.resize(n);
+		depth_.resize(n);
+		mask_.resize(n);
+		visible_ = 0;
+	}
+
+	void projectPoint(size_t i, float px, float py, float pz)
+	{
+		Eigen::Vector4f x(px, py, pz, 1.0f);
+		Eigen::Vector4f uvw = matrix_ * x;
+		float w = uvw(2);
+		depth_[i] = w;
+		if(!(w > 0.0f)){
+			u_[i] = v_[i] = -1.0f;
+			mask_[i] = 0;
+			return;
+		}
+		float u = uvw(0) / w, v = uvw(1) / w;
+		u_[i] = u;
+		v_[i] = v;
+		// compared as floats, the int cast would wrap far outside the frame
+		bool in_frame = u >= x0_ && u < x1_ && v >= y0_ && v < y1_;
+		mask_[i] = in_frame ? PROJECTION_VISIBLE : PROJECTION_IN_FRONT;
+		visible_ += in_frame;
+	}
+
+	// last row zero, so a 4-vector product fills u w, v w, w
+	Eigen::Matrix4f matrix_;
+	int x0_, y0_, x1_, y1_;
+
+	std::vector<float> u_, v_, depth_;
+	std::vector<uint8_t> mask_;
+	size_t visible_;
+};
+
+} // namespace infant_utils
+
+#endif /* INFANT_UTILS_BATCH_PROJECTION_H_ */
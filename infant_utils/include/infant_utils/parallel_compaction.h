@@ -0,0 +1,241 @@
+/*
+ * parallel_compaction.h
+ *
+ * Predicate-driven stream compaction for point buffers.
+ *
+ * The input is split into one contiguous chunk per thread. Every thread
+ * evaluates the predicate on its chunk and counts the survivors, an exclusive
+ * prefix sum over the counts gives each chunk its output offset, and the
+ * chunks are then scattered without any synchronisation. The relative order
+ * of the kept points is preserved, so organized scans stay in scan order.
+ *
+ * Header only; without OpenMP everything runs on one thread.
+ */
+
+#ifndef INFANT_UTILS_PARALLEL_COMPACTION_H_
+#define INFANT_UTILS_PARALLEL_COMPACTION_H_
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <pcl/point_cloud.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
+
+namespace infant_utils
+{
+
+namespace detail
+{
+
+// below this size the thread start-up costs more than the filter itself
+const size_t PARALLEL_COMPACTION_MIN = 4096;
+
+inline int compactionThreads(size_t n)
+{
+#ifdef _OPENMP
+	if(n >= PARALLEL_COMPACTION_MIN){
+		return omp_get_max_threads();
+	}
+#endif
+	return 1;
+}
+
+inline void chunk(size_t n, int threads, int t, size_t &begin, size_t &end)
+{
+	begin = n * t / threads;
+	end = n * (t + 1) / threads;
+}
+
+/*
+ * Evaluates keep(i) for i in [0, n) once, writes the flags and returns the
+ * per-chunk output offsets (offset[threads] is the total).
+ */
+template<class Keep>
+void countKept(size_t n, int threads, Keep keep, std::vector<unsigned char> &flags, std::vector<size_t> &offset)
+{
+	flags.resize(n);
+	offset.assign(threads + 1, 0);
+
+	// one chunk per iteration, so a smaller team still covers the whole input
+#pragma omp parallel for if(threads > 1)
+	for(int t = 0; t < threads; t++){
+		size_t begin, end;
+		chunk(n, threads, t, begin, end);
+		size_t cnt = 0;
+		for(size_t i = begin; i < end; i++){
+			flags[i] = keep(i) ? 1 : 0;
+			cnt += flags[i];
+		}
+		offset[t + 1] = cnt;
+	}
+
+	for(int t = 0; t < threads; t++){
+		offset[t + 1] += offset[t];
+	}
+}
+
+} // namespace detail
+
+/*
+ * Copies the elements of in for which keep(element) holds into out.
+ * out is resized once to the number of survivors; in and out must differ.
+ * Returns the number of survivors.
+ */
+template<class T, class Alloc, class Pred>
+size_t compactTo(const std::vector<T, Alloc> &in, std::vector<T, Alloc> &out, Pred keep)
+{
+	size_t n = in.size();
+	int threads = detail::compactionThreads(n);
+	std::vector<unsigned char> flags;
+	std::vector<size_t> offset;
+	detail::countKept(n, threads, [&](size_t i){ return keep(in[i]); }, flags, offset);
+
+	out.resize(offset[threads]);
+
+#pragma omp parallel for if(threads > 1)
+	for(int t = 0; t < threads; t++){
+		size_t begin, end;
+		detail::chunk(n, threads, t, begin, end);
+		size_t o = offset[t];
+		for(size_t i = begin; i < end; i++){
+			if(flags[i]) out[o++] = in[i];
+		}
+	}
+	return offset[threads];
+}
+
+/*
+ * Removes the elements for which keep(element) is false, keeping the order.
+ * Every thread first packs its own chunk towards the chunk start, then the
+ * packed chunks are slid down to their final offsets.
+ */
+template<class T, class Alloc, class Pred>
+size_t compactInPlace(std::vector<T, Alloc> &v, Pred keep)
+{
+	size_t n = v.size();
+	int threads = detail::compactionThreads(n);
+	std::vector<size_t> kept(threads, 0);
+
+#pragma omp parallel for if(threads > 1)
+	for(int t = 0; t < threads; t++){
+		size_t begin, end;
+		detail::chunk(n, threads, t, begin, end);
+		size_t o = begin;
+		for(size_t i = begin; i < end; i++){
+			if(keep(v[i])){
+				if(o != i) v[o] = v[i];
+				o++;
+			}
+		}
+		kept[t] = o - begin;
+	}
+
+	// destinations never pass their sources, so a forward pass is safe
+	size_t o = 0;
+	for(int t = 0; t < threads; t++){
+		size_t begin, end;
+		detail::chunk(n, threads, t, begin, end);
+		if(o != begin){
+			std::copy(v.begin() + begin, v.begin() + begin + kept[t], v.begin() + o);
+		}
+		o += kept[t];
+	}
+	v.resize(o);
+	return o;
+}
+
+/*
+ * pcl::PointCloud versions. The result is an unorganized cloud
+ * (height = 1); the header, sensor origin and orientation are kept.
+ */
+template<class PointT, class Pred>
+size_t compact(pcl::PointCloud<PointT> &cloud, Pred keep)
+{
+	size_t n = compactInPlace(cloud.points, keep);
+	cloud.width = n;
+	cloud.height = 1;
+	return n;
+}
+
+template<class PointT, class Pred>
+size_t compact(const pcl::PointCloud<PointT> &in, pcl::PointCloud<PointT> &out, Pred keep)
+{
+	out.header = in.header;
+	out.sensor_origin_ = in.sensor_origin_;
+	out.sensor_orientation_ = in.sensor_orientation_;
+	out.is_dense = in.is_dense;
+	size_t n = compactTo(in.points, out.points, keep);
+	out.width = n;
+	out.height = 1;
+	return n;
+}
+
+// byte offset of a FLOAT32 field, -1 if the cloud has none
+inline int floatFieldOffset(const sensor_msgs::PointCloud2 &msg, const std::string &name)
+{
+	for(size_t i = 0; i < msg.fields.size(); i++){
+		if(msg.fields[i].name == name && msg.fields[i].datatype == sensor_msgs::PointField::FLOAT32){
+			return msg.fields[i].offset;
+		}
+	}
+	return -1;
+}
+
+// reads a FLOAT32 field of one point (the data of a PointCloud2 is not aligned)
+inline float readFloat(const uint8_t *point, int offset)
+{
+	float v;
+	memcpy(&v, point + offset, sizeof(float));
+	return v;
+}
+
+/*
+ * PointCloud2 version, working on the raw point records so that every field
+ * of the input survives. keep is called with a pointer to the first byte of
+ * a point. The rows are assumed to be packed (row_step = width * point_step).
+ */
+template<class Pred>
+size_t compact(const sensor_msgs::PointCloud2 &in, sensor_msgs::PointCloud2 &out, Pred keep)
+{
+	size_t n = (size_t)in.width * in.height;
+	size_t step = in.point_step;
+	int threads = detail::compactionThreads(n);
+	std::vector<unsigned char> flags;
+	std::vector<size_t> offset;
+	detail::countKept(n, threads, [&](size_t i){ return keep(&in.data[i * step]); }, flags, offset);
+
+	out.header = in.header;
+	out.fields = in.fields;
+	out.is_bigendian = in.is_bigendian;
+	out.point_step = in.point_step;
+	out.is_dense = in.is_dense;
+	out.height = 1;
+	out.width = offset[threads];
+	out.row_step = out.width * out.point_step;
+	out.data.resize(out.row_step);
+
+#pragma omp parallel for if(threads > 1)
+	for(int t = 0; t < threads; t++){
+		size_t begin, end;
+		detail::chunk(n, threads, t, begin, end);
+		size_t o = offset[t];
+		for(size_t i = begin; i < end; i++){
+			if(flags[i]){
+				memcpy(&out.data[o * step], &in.data[i * step], step);
+				o++;
+			}
+		}
+	}
+	return offset[threads];
+}
+
+} // namespace infant_utils
+
+#endif /* INFANT_UTILS_PARALLEL_COMPACTION_H_ */
@@ -0,0 +1,128 @@
+/*
+ * stamped_buffer.h
+ *
+ * Fixed-capacity ring buffer of time-stamped values, oldest first.
+ *
+ * Messages are pushed in stamp order, so the entries stay sorted and a
+ * lookup by time is a binary search over the ring. When the buffer is
+ * full the oldest entry is overwritten; a stamp older than the newest one
+ * (a rosbag jumping back) clears the history first.
+ *
+ * Header only.
+ */
+
+#ifndef INFANT_UTILS_STAMPED_BUFFER_H_
+#define INFANT_UTILS_STAMPED_BUFFER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include <ros/time.h>
+
+namespace infant_utils
+{
+
+template<class T>
+class StampedBuffer
+{
+public:
+	explicit StampedBuffer(size_t capacity = 16) : head_(0), size_(0)
+	{
+		setCapacity(capacity);
+	}
+
+	// drops the contents
+	void setCapacity(size_t capacity)
+	{
+		stamps_.assign(capacity > 0 ? capacity : 1, ros::Time());
+		values_.assign(stamps_.size(), T());
+		clear();
+	}
+
+	size_t capacity() const { return stamps_.size(); }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	void clear()
+	{
+		head_ = 0;
+		size_ = 0;
+	}
+
+	void push(const ros::Time &stamp, const T &value)
+	{
+		if(size_ > 0 && stamp < this->stamp(size_ - 1)) clear();
+		size_t slot = (head_ + size_) % capacity();
+		if(size_ == capacity()){
+			head_ = (head_ + 1) % capacity();
+		}
+		else{
+			size_++;
+		}
+		stamps_[slot] = stamp;
+		values_[slot] = value;
+	}
+
+	// k-th entry, 0 is the oldest
+	const ros::Time &stamp(size_t k) const { return stamps_[(head_ + k) % capacity()]; }
+	const T &value(size_t k) const { return values_[(head_ + k) % capacity()]; }
+	T &value(size_t k) { return values_[(head_ + k) % capacity()]; }
+
+	// first entry with a stamp >= t, size() if none
+	size_t lowerBound(const ros::Time &t) const
+	{
+		size_t first = 0, count = size_;
+		while(count > 0){
+			size_t step = count / 2;
+			if(stamp(first + step) < t){
+				first += step + 1;
+				count -= step + 1;
+			}
+			else{
+				count = step;
+			}
+		}
+		return first;
+	}
+
+	// entry closest to t, -1 if empty
+	int nearest(const ros::Time &t) const
+	{
+		if(size_ == 0) return -1;
+		size_t k = lowerBound(t);
+		if(k == size_) return size_ - 1;
+		if(k == 0) return 0;
+		double before = (t - stamp(k - 1)).toSec();
+		double after = (stamp(k) - t).toSec();
+		return before <= after ? k - 1 : k;
+	}
+
+	/*
+	 * Entries around t for interpolation: stamp(lower) <= t <= stamp(upper),
+	 * upper is lower + 1 or lower itself on an exact hit, and ratio in [0, 1]
+	 * goes from lower to upper. False if t is outside the buffered span.
+	 */
+	bool bracket(const ros::Time &t, size_t &lower, size_t &upper, double &ratio) const
+	{
+		if(size_ == 0 || t < stamp(0) || t > stamp(size_ - 1)) return false;
+		upper = lowerBound(t);
+		if(stamp(upper) == t){
+			lower = upper;
+			ratio = 0.0;
+			return true;
+		}
+		lower = upper - 1;
+		ratio = (t - stamp(lower)).toSec() / (stamp(upper) - stamp(lower)).toSec();
+		return true;
+	}
+
+private:
+	std::vector<ros::Time> stamps_;
+	std::vector<T> values_;
+	size_t head_;
+	size_t size_;
+};
+
+} // namespace infant_utils
+
+#endif /* INFANT_UTILS_STAMPED_BUFFER_H_ */
@@ -0,0 +1,190 @@
+/*
+ * trajectory_buffer.h
+ *
+ * Bounded trajectory history for visualizers and trackers.
+ *
+ * Samples closer than min_distance / min_interval to the last kept one
+ * only move the tip of the trajectory, so a standing target does not
+ * fill the buffer. When the buffer is full, the older half is simplified
+ * with Douglas-Peucker (simplify_tolerance > 0) to make room; only if
+ * that frees nothing is the oldest sample dropped. Every sample goes
+ * through the simplification once, not on every push of a full buffer.
+ *
+ * Header only.
+ */
+
+#ifndef INFANT_UTILS_TRAJECTORY_BUFFER_H_
+#define INFANT_UTILS_TRAJECTORY_BUFFER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <ros/time.h>
+
+namespace infant_utils
+{
+
+struct TrajectoryPoint
+{
+	double x, y, z;
+	ros::Time stamp;
+};
+
+struct TrajectoryParams
+{
+	size_t capacity;
+	// decimation, a sample is kept when it is this far from the last kept one [m]
+	double min_distance;
+	// ... and this much later [s]
+	double min_interval;
+	// Douglas-Peucker tolerance for the old half, 0 : drop the oldest instead [m]
+	double simplify_tolerance;
+
+	TrajectoryParams() :
+		capacity(1000), min_distance(0.05), min_interval(0.0), simplify_tolerance(0.02)
+	{
+	}
+};
+
+class TrajectoryBuffer
+{
+public:
+	explicit TrajectoryBuffer(const TrajectoryParams &params = TrajectoryParams())
+	{
+		setParams(params);
+	}
+
+	// drops the contents
+	void setParams(const TrajectoryParams &params)
+	{
+		params_ = params;
+		params_.capacity = std::max<size_t>(params_.capacity, 3);
+		points_.assign(params_.capacity, TrajectoryPoint());
+		clear();
+	}
+
+	const TrajectoryParams &params() const { return params_; }
+
+	void clear()
+	{
+		head_ = 0;
+		size_ = 0;
+		simplified_ = 0;
+	}
+
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	// k-th sample, 0 is the oldest
+	const TrajectoryPoint &operator[](size_t k) const { return points_[(head_ + k) % points_.size()]; }
+
+	// true if p became a new sample, false if it only moved the tip
+	bool push(const TrajectoryPoint &p)
+	{
+		if(size_ > 0 && !farEnough(p)){
+			// the tip follows the target, last_ stays the decimation reference
+			at(size_ - 1) = p;
+			return false;
+		}
+		if(size_ == points_.size()) makeRoom();
+		at(size_) = p;
+		size_++;
+		last_ = p;
+		return true;
+	}
+
+private:
+	TrajectoryPoint &at(size_t k) { return points_[(head_ + k) % points_.size()]; }
+
+	bool farEnough(const TrajectoryPoint &p) const
+	{
+		double dx = p.x - last_.x, dy = p.y - last_.y, dz = p.z - last_.z;
+		if(dx * dx + dy * dy + dz * dz < params_.min_distance * params_.min_distance) return false;
+		return (p.stamp - last_.stamp).toSec() >= params_.min_interval;
+	}
+
+	void makeRoom()
+	{
+		if(params_.simplify_tolerance > 0.0 && simplify()) return;
+		head_ = (head_ + 1) % points_.size();
+		size_--;
+		if(simplified_ > 0) simplified_--;
+	}
+
+	// Douglas-Peucker over the samples not simplified yet in the older half
+	bool simplify()
+	{
+		// full, so the ring is one rotation away from a plain array
+		std::rotate(points_.begin(), points_.begin() + head_, points_.end());
+		head_ = 0;
+
+		size_t first = simplified_ > 0 ? simplified_ - 1 : 0;
+		size_t last = size_ / 2;
+		if(last < first + 2) return false;
+
+		keep_.assign(last - first + 1, 0);
+		keep_.front() = keep_.back() = 1;
+		stack_.clear();
+		stack_.push_back(std::make_pair(first, last));
+		double tol2 = params_.simplify_tolerance * params_.simplify_tolerance;
+		while(!stack_.empty()){
+			size_t a = stack_.back().first, b = stack_.back().second;
+			stack_.pop_back();
+			double worst = -1.0;
+			size_t worst_k = a;
+			for(size_t k = a + 1; k < b; k++){
+				double d = distance2(points_[k], points_[a], points_[b]);
+				if(d > worst){
+					worst = d;
+					worst_k = k;
+				}
+			}
+			if(worst > tol2){
+				keep_[worst_k - first] = 1;
+				if(worst_k - a > 1) stack_.push_back(std::make_pair(a, worst_k));
+				if(b - worst_k > 1) stack_.push_back(std::make_pair(worst_k, b));
+			}
+		}
+
+		size_t out = first;
+		for(size_t k = first; k <= last; k++){
+			if(keep_[k - first]) points_[out++] = points_[k];
+		}
+		size_t removed = last + 1 - out;
+		std::copy(points_.begin() + last + 1, points_.begin() + size_, points_.begin() + out);
+		size_ -= removed;
+		simplified_ = out;
+		return removed > 0;
+	}
+
+	// squared distance from p to the segment a-b
+	static double distance2(const TrajectoryPoint &p, const TrajectoryPoint &a, const TrajectoryPoint &b)
+	{
+		double abx = b.x - a.x, aby = b.y - a.y, abz = b.z - a.z;
+		double apx = p.x - a.x, apy = p.y - a.y, apz = p.z - a.z;
+		double len2 = abx * abx + aby * aby + abz * abz;
+		double t = len2 > 0.0 ? (apx * abx + apy * aby + apz * abz) / len2 : 0.0;
+		t = std::max(0.0, std::min(1.0, t));
+		double dx = apx - t * abx, dy = apy - t * aby, dz = apz - t * abz;
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	TrajectoryParams params_;
+	std::vector<TrajectoryPoint> points_;
+	size_t head_;
+	size_t size_;
+	// samples [0, simplified_) went through Douglas-Peucker already
+	size_t simplified_;
+	// last kept sample, the reference of the decimation
+	TrajectoryPoint last_;
+
+	std::vector<char> keep_;
+	std::vector<std::pair<size_t, size_t> > stack_;
+};
+
+} // namespace infant_utils
+
+#endif /* INFANT_UTILS_TRAJECTORY_BUFFER_H_ */
@@ -9,6 +9,8 @@
 
 #include <boost/thread.hpp>
 
+#include <infant_utils/parallel_compaction.h>
+
 using namespace std;
 
 
@@ -19,28 +21,39 @@ typedef pcl::PointCloud<PointType> CloudType;
 
 #define RANGE_CONSTRAINT 7.5
 
+/*
+ * /velodyne_points/constraint : pcl::PointNormal with x, y, z of the input
+ * and zero normals and curvature. The raw records are compacted first, so
+ * only the points inside the box are converted.
+ */
 void velPointCallback(const sensor_msgs::PointCloud2ConstPtr& msg)
 {
-	CloudType::Ptr input_points (new CloudType);
-	CloudType::Ptr output_points (new CloudType);
-	pcl::fromROSMsg(*msg, *input_points);
-
-	size_t input_size = input_points->points.size();
-	for(size_t i = 0; i < input_size; i++){
-		PointType temp_point;
-		temp_point.x = input_points->points[i].x; 
-		temp_point.y = input_points->points[i].y;
-		temp_point.z = input_points->points[i].z;
-		if((-1.0*RANGE_CONSTRAINT <= temp_point.x && temp_point.x <= RANGE_CONSTRAINT) \
-				&& (-1.0*RANGE_CONSTRAINT <= temp_point.y && temp_point.y <= RANGE_CONSTRAINT))
-		{
-			output_points->points.push_back(temp_point);
-		}
+	int off_x = infant_utils::floatFieldOffset(*msg, "x");
+	int off_y = infant_utils::floatFieldOffset(*msg, "y");
+	int off_z = infant_utils::floatFieldOffset(*msg, "z");
+	if(off_x < 0 || off_y < 0 || off_z < 0) return;
+
+	sensor_msgs::PointCloud2 inside;
+	size_t output_size = infant_utils::compact(*msg, inside, [&](const uint8_t *p){
+		float x = infant_utils::readFloat(p, off_x);
+		float y = infant_utils::readFloat(p, off_y);
+		return (-1.0*RANGE_CONSTRAINT <= x && x <= RANGE_CONSTRAINT) \
+				&& (-1.0*RANGE_CONSTRAINT <= y && y <= RANGE_CONSTRAINT);
+	});
+
+	CloudType output_points;
+	output_points.points.resize(output_size);
+	for(size_t i = 0; i < output_size; i++){
+		const uint8_t *p = &inside.data[i * inside.point_step];
+		output_points.points[i].x = infant_utils::readFloat(p, off_x);
+		output_points.points[i].y = infant_utils::readFloat(p, off_y);
+		output_points.points[i].z = infant_utils::readFloat(p, off_z);
 	}
-	
+	output_points.width = output_size;
+	output_points.height = 1;
+
 	sensor_msgs::PointCloud2 output_pc2;
-	pcl::toROSMsg(*output_points, output_pc2);
-	// pcl::toROSMsg(*input_points, output_pc2);
+	pcl::toROSMsg(output_points, output_pc2);
 	output_pc2.header = msg->header;
     pub.publish(output_pc2);
 }
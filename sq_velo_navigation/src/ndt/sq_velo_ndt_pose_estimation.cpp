@@ -26,6 +26,8 @@
 
 #include <boost/thread.hpp>
 
+#include <infant_utils/parallel_compaction.h>
+
 // #include "ray_casting.h"
 
 using namespace std;
@@ -143,17 +145,9 @@ void velodyne_callback(const sensor_msgs::PointCloud2 msg){
 	temp.header.stamp = ros::Time::now();
 	PointCloud2_to_PointXYZ(&temp, &velodyne_points__);
 	
-	velodyne_points_->points.clear();
-	size_t velodyne_size = velodyne_points__->points.size();
-	for(size_t i = 0; i < velodyne_size; i++){
-		pcl::PointXYZ temp_point;
-		temp_point.x = velodyne_points__->points[i].x; 
-		temp_point.y = velodyne_points__->points[i].y;
-		temp_point.z = velodyne_points__->points[i].z;
-		if((-10.0 <= temp_point.x && temp_point.x <= 10.0) && (-10.0 <= temp_point.y && temp_point.y <= 10.0)){
-			velodyne_points_->points.push_back(temp_point);
-		}
-	}
+	infant_utils::compact(*velodyne_points__, *velodyne_points_, [](const pcl::PointXYZ &p){
+		return (-10.0 <= p.x && p.x <= 10.0) && (-10.0 <= p.y && p.y <= 10.0);
+	});
 
 	// cout<<"velodyne_points_->points.size()"<<velodyne_points_->points.size()<<endl;
 	velodyne_sub_flag = true;